@@ -0,0 +1,115 @@
+#ifndef _BLEND_H_
+#define _BLEND_H_
+
+#include <vector>
+
+#include "PixelFormat.h"
+
+namespace GFX {
+
+// Lookup tables to blend one color over the pixels of format F at the
+// coverage levels of anti-aliased glyphs: the result for every level and
+// every possible pixel value, so blending a pixel is one load, one table
+// lookup and one store.  prepare() rebuilds the tables only when the
+// color or the number of levels changes.
+template<class F>
+class BlendTable {
+public:
+	typedef typename F::unit_t unit_t;
+
+	BlendTable() : color(0), max(0) {
+		//nothing
+	}
+
+	// Blend the native color at levels 0 to max
+	void prepare(color_t c, unsigned m) {
+		if (c == color && m == max)
+			return;
+		color = c;
+		max = m;
+		table.resize((m + 1) << F::BITS);
+		for (unsigned a = 0; a <= m; a++) {
+			for (color_t d = 0; d < (1u << F::BITS); d++) {
+				table[(a << F::BITS) | d] = F::mix(d, c, a, m);
+			}
+		}
+	}
+
+	// Pixels x0..x1 of line at coverage level
+	void blend(unit_t *line, coord_t x0, coord_t x1, unsigned level) const {
+		const unit_t *t = table.data() + (level << F::BITS);
+		for (coord_t x = x0; x <= x1; x++) {
+			F::put(line, x, t[F::get(line, x)]);
+		}
+	}
+	// n pixels of line from x0 on at their levels, level 0 keeps the pixel
+	void blend(unit_t *line, coord_t x0, const uint8_t *levels, coord_t n) const {
+		const unit_t *t = table.data();
+		for (coord_t i = 0; i < n; i++) {
+			if (levels[i])
+				F::put(line, x0 + i, t[(levels[i] << F::BITS) | F::get(line, x0 + i)]);
+		}
+	}
+
+private:
+	color_t color;
+	unsigned max;
+	std::vector<unit_t> table;
+};
+
+// RGB 5/6/5 has too many pixel values for one table, it is blended one
+// channel at a time with a table per channel
+template<>
+class BlendTable<Format16bpp> {
+public:
+	typedef Format16bpp::unit_t unit_t;
+
+	BlendTable() : color(0), max(0) {
+		//nothing
+	}
+
+	void prepare(color_t c, unsigned m) {
+		if (c == color && m == max)
+			return;
+		color = c;
+		max = m;
+		table.resize((m + 1) * 128);
+		for (unsigned a = 0; a <= m; a++) {
+			uint16_t *t = &table[a * 128];
+			for (color_t d = 0; d < 32; d++) {
+				t[d] = Format16bpp::mixField(d << 11, c, a, m, 11, 0x1F);
+				t[96 + d] = Format16bpp::mixField(d, c, a, m, 0, 0x1F);
+			}
+			for (color_t d = 0; d < 64; d++) {
+				t[32 + d] = Format16bpp::mixField(d << 5, c, a, m, 5, 0x3F);
+			}
+		}
+	}
+
+	void blend(unit_t *line, coord_t x0, coord_t x1, unsigned level) const {
+		const uint16_t *t = &table[level * 128];
+		for (coord_t x = x0; x <= x1; x++) {
+			unit_t d = line[x];
+			line[x] = t[d >> 11] | t[32 + ((d >> 5) & 0x3F)] | t[96 + (d & 0x1F)];
+		}
+	}
+	void blend(unit_t *line, coord_t x0, const uint8_t *levels, coord_t n) const {
+		line += x0;
+		for (coord_t i = 0; i < n; i++) {
+			if (levels[i]) {
+				const uint16_t *t = &table[levels[i] * 128];
+				unit_t d = line[i];
+				line[i] = t[d >> 11] | t[32 + ((d >> 5) & 0x3F)] | t[96 + (d & 0x1F)];
+			}
+		}
+	}
+
+private:
+	color_t color;
+	unsigned max;
+	std::vector<uint16_t> table; // per level: red, green, blue fields
+};
+
+}
+
+#endif // _BLEND_H_
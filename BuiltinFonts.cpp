@@ -0,0 +1,60 @@
+#include "FontRegistry.h"
+
+using namespace GFX;
+
+// Kept apart from FontRegistry.cpp, so programs that only load font files
+// do not link all fonts in.
+void FontRegistry::addBuiltinFonts() {
+	add("FreeMono", 9, &FreeMono9pt7b);
+	add("FreeMono", 12, &FreeMono12pt7b);
+	add("FreeMono", 18, &FreeMono18pt7b);
+	add("FreeMono", 24, &FreeMono24pt7b);
+	add("FreeMonoBold", 9, &FreeMonoBold9pt7b);
+	add("FreeMonoBold", 12, &FreeMonoBold12pt7b);
+	add("FreeMonoBold", 18, &FreeMonoBold18pt7b);
+	add("FreeMonoBold", 24, &FreeMonoBold24pt7b);
+	add("FreeMonoBoldOblique", 9, &FreeMonoBoldOblique9pt7b);
+	add("FreeMonoBoldOblique", 12, &FreeMonoBoldOblique12pt7b);
+	add("FreeMonoBoldOblique", 18, &FreeMonoBoldOblique18pt7b);
+	add("FreeMonoBoldOblique", 24, &FreeMonoBoldOblique24pt7b);
+	add("FreeMonoOblique", 9, &FreeMonoOblique9pt7b);
+	add("FreeMonoOblique", 12, &FreeMonoOblique12pt7b);
+	add("FreeMonoOblique", 18, &FreeMonoOblique18pt7b);
+	add("FreeMonoOblique", 24, &FreeMonoOblique24pt7b);
+	add("FreeSans", 9, &FreeSans9pt7b);
+	add("FreeSans", 12, &FreeSans12pt7b);
+	add("FreeSans", 18, &FreeSans18pt7b);
+	add("FreeSans", 24, &FreeSans24pt7b);
+	add("FreeSansBold", 9, &FreeSansBold9pt7b);
+	add("FreeSansBold", 12, &FreeSansBold12pt7b);
+	add("FreeSansBold", 18, &FreeSansBold18pt7b);
+	add("FreeSansBold", 24, &FreeSansBold24pt7b);
+	add("FreeSansBoldOblique", 9, &FreeSansBoldOblique9pt7b);
+	add("FreeSansBoldOblique", 12, &FreeSansBoldOblique12pt7b);
+	add("FreeSansBoldOblique", 18, &FreeSansBoldOblique18pt7b);
+	add("FreeSansBoldOblique", 24, &FreeSansBoldOblique24pt7b);
+	add("FreeSansOblique", 9, &FreeSansOblique9pt7b);
+	add("FreeSansOblique", 12, &FreeSansOblique12pt7b);
+	add("FreeSansOblique", 18, &FreeSansOblique18pt7b);
+	add("FreeSansOblique", 24, &FreeSansOblique24pt7b);
+	add("FreeSerif", 9, &FreeSerif9pt7b);
+	add("FreeSerif", 12, &FreeSerif12pt7b);
+	add("FreeSerif", 18, &FreeSerif18pt7b);
+	add("FreeSerif", 24, &FreeSerif24pt7b);
+	add("FreeSerifBold", 9, &FreeSerifBold9pt7b);
+	add("FreeSerifBold", 12, &FreeSerifBold12pt7b);
+	add("FreeSerifBold", 18, &FreeSerifBold18pt7b);
+	add("FreeSerifBold", 24, &FreeSerifBold24pt7b);
+	add("FreeSerifBoldItalic", 9, &FreeSerifBoldItalic9pt7b);
+	add("FreeSerifBoldItalic", 12, &FreeSerifBoldItalic12pt7b);
+	add("FreeSerifBoldItalic", 18, &FreeSerifBoldItalic18pt7b);
+	add("FreeSerifBoldItalic", 24, &FreeSerifBoldItalic24pt7b);
+	add("FreeSerifItalic", 9, &FreeSerifItalic9pt7b);
+	add("FreeSerifItalic", 12, &FreeSerifItalic12pt7b);
+	add("FreeSerifItalic", 18, &FreeSerifItalic18pt7b);
+	add("FreeSerifItalic", 24, &FreeSerifItalic24pt7b);
+	add("Org_01", 0, &Org_01);
+	add("Picopixel", 0, &Picopixel);
+	add("Tiny3x3a", 2, &Tiny3x3a2pt7b);
+	add("TomThumb", 0, &TomThumb);
+}
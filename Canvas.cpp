@@ -32,9 +32,14 @@
  */
 
 #include "Canvas.h"
+#include "CanvasT.h"
+#include "Primitives.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 
 using namespace GFX;
 
@@ -299,10 +304,6 @@ static const unsigned char glcdfont[] = {
 };
 
 
-static inline int16_t min(int16_t a, int16_t b) {
-	return a < b ? a : b;
-}
-
 static inline void swapCoords(coord_t &a, coord_t &b) {
 	coord_t t = a;
 	a = b;
@@ -317,68 +318,211 @@ static inline void sortCoords(coord_t &a, coord_t &b) {
 }
 
 Canvas::Canvas(coord_t w, coord_t h) :
-		WIDTH(w), HEIGHT(h) {
+		runCache(RUN_CACHE_SIZE), layoutCache(LAYOUT_CACHE_SIZE), WIDTH(w), HEIGHT(h) {
 	cursor_y = cursor_x = 0;
 	textheight = 1;
 	wrap = false;
+	textFill = false;
+	fontTop = fontBottom = 0;
 	gfxFont = NULL;
+	gfxFont2 = NULL;
+	kernPrev = 0;
+	fontGeneration = fontEpoch.load(std::memory_order_relaxed);
+	clip.x0 = 0;
+	clip.y0 = 0;
+	clip.x1 = WIDTH - 1;
+	clip.y1 = HEIGHT - 1;
 	setRotation(0);
 }
 
+static inline size_t area(const rect_t &r) {
+	return (size_t) (r.x1 - r.x0 + 1) * (r.y1 - r.y0 + 1);
+}
+
+static inline rect_t unite(const rect_t &a, const rect_t &b) {
+	rect_t u;
+	u.x0 = std::min(a.x0, b.x0);
+	u.y0 = std::min(a.y0, b.y0);
+	u.x1 = std::max(a.x1, b.x1);
+	u.y1 = std::max(a.y1, b.y1);
+	return u;
+}
+
+void DamageList::add(const rect_t &r) {
+	if (r.x0 > r.x1 || r.y0 > r.y1)
+		return;
+
+	// fast path: repeated writes into the same area
+	if (last < rects.size()) {
+		const rect_t &l = rects[last];
+		if (r.x0 >= l.x0 && r.y0 >= l.y0 && r.x1 <= l.x1 && r.y1 <= l.y1)
+			return;
+	}
+
+	// merge with the rect whose union wastes the fewest pixels
+	size_t best = rects.size();
+	size_t bestWaste = SIZE_MAX;
+	for (size_t i = 0; i < rects.size(); i++) {
+		const rect_t &d = rects[i];
+		rect_t u = unite(d, r);
+		size_t covered = area(d) + area(r);
+		size_t waste = area(u) > covered ? area(u) - covered : 0;
+		if (waste < bestWaste) {
+			best = i;
+			bestWaste = waste;
+		}
+	}
+
+	if (best < rects.size() && (bestWaste == 0 || rects.size() >= MAX_RECTS)) {
+		rects[best] = unite(rects[best], r);
+		last = best;
+	} else {
+		rects.push_back(r);
+		last = rects.size() - 1;
+	}
+}
+
+void DamageList::add(const DamageList &other) {
+	for (size_t i = 0; i < other.rects.size(); i++) {
+		add(other.rects[i]);
+	}
+}
+
+rect_t Canvas::bitmapBounds(coord_t x, coord_t y, coord_t w, coord_t h, coord_t size) const {
+	rect_t r;
+	if (w <= 0 || h <= 0) {
+		r.x0 = r.y0 = 0;
+		r.x1 = r.y1 = -1;
+		return r;
+	}
+	coord_t ex = w * size - 1;
+	coord_t ey = h * size - 1;
+	r.x0 = x;
+	r.y0 = y;
+	r.x1 = x + mrot[0] * ex + mrot[1] * ey;
+	r.y1 = y + mrot[2] * ex + mrot[3] * ey;
+	sortCoords(r.x0, r.x1);
+	sortCoords(r.y0, r.y1);
+	return r;
+}
+
+rect_t Canvas::deviceRect(const rect_t &r) {
+	rect_t d;
+	if (r.x0 > r.x1 || r.y0 > r.y1) {
+		d.x0 = d.y0 = 0;
+		d.x1 = d.y1 = -1;
+		return d;
+	}
+	d.x0 = realX(r.x0, r.y0);
+	d.y0 = realY(r.x0, r.y0);
+	d.x1 = realX(r.x1, r.y1);
+	d.y1 = realY(r.x1, r.y1);
+	sortCoords(d.x0, d.x1);
+	sortCoords(d.y0, d.y1);
+	return d;
+}
+
+void Canvas::damageRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1) {
+	rect_t r;
+	r.x0 = std::max(x0, clip.x0);
+	r.y0 = std::max(y0, clip.y0);
+	r.x1 = std::min(x1, clip.x1);
+	r.y1 = std::min(y1, clip.y1);
+	damage.add(r);
+}
+
+const DamageList &Canvas::getDamage() const {
+	return damage;
+}
+
+void Canvas::clearDamage() {
+	damage.clear();
+}
+
+void Canvas::pushClip(coord_t x0, coord_t y0, coord_t x1, coord_t y1) {
+	coord_t rx0 = realX(x0, y0);
+	coord_t ry0 = realY(x0, y0);
+	coord_t rx1 = realX(x1, y1);
+	coord_t ry1 = realY(x1, y1);
+
+	sortCoords(rx0, rx1);
+	sortCoords(ry0, ry1);
+
+	clipStack.push_back(clip);
+	clip.x0 = std::max(clip.x0, rx0);
+	clip.y0 = std::max(clip.y0, ry0);
+	clip.x1 = std::min(clip.x1, rx1);
+	clip.y1 = std::min(clip.y1, ry1);
+}
+
+void Canvas::popClip() {
+	if (clipStack.empty())
+		return;
+	clip = clipStack.back();
+	clipStack.pop_back();
+}
+
 void Canvas::initColors() {
 	setBgColor(COLOR_BLACK);
 	setDrawColor(COLOR_WHITE);
 	setTextColor(COLOR_WHITE);
 }
 
-Canvas::~Canvas() {
-	// nothing
+void Canvas::reset() {
+	selectFont(NULL, NULL, NULL);
+	cursor_y = cursor_x = 0;
+	textheight = 1;
+	wrap = false;
+	textFill = false;
+	clipStack.clear();
+	clip.x0 = 0;
+	clip.y0 = 0;
+	clip.x1 = WIDTH - 1;
+	clip.y1 = HEIGHT - 1;
+	setRotation(0);
+	initColors();
+	clearDamage();
 }
 
-// Bresenham's algorithm - thx wikpedia
-void Canvas::writeLine(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color) {
-	coord_t steep = abs(y1 - y0) > abs(x1 - x0);
-	if (steep) {
-		swapCoords(x0, y0);
-		swapCoords(x1, y1);
-	}
+std::atomic<uint32_t> Canvas::fontEpoch(0);
 
-	if (x0 > x1) {
-		swapCoords(x0, x1);
-		swapCoords(y0, y1);
-	}
+void Canvas::forgetFonts() {
+	fontEpoch.fetch_add(1, std::memory_order_relaxed);
+}
 
-	coord_t dx, dy;
-	dx = x1 - x0;
-	dy = std::abs(y1 - y0);
+void Canvas::clearGlyphCache() {
+	runCache.clear();
+}
 
-	coord_t err = dx / 2;
-	coord_t ystep;
+void Canvas::clearFontCaches() {
+	fontGeneration = fontEpoch.load(std::memory_order_relaxed);
+	clearGlyphCache();
+	layoutCache.clear();
+	preparedFonts.clear();
+}
 
-	if (y0 < y1) {
-		ystep = 1;
-	} else {
-		ystep = -1;
-	}
+Canvas::~Canvas() {
+	// nothing
+}
 
-	for (; x0 <= x1; x0++) {
-		if (steep) {
-			writePixel(y0, x0, color);
-		} else {
-			writePixel(x0, y0, color);
-		}
-		err -= dy;
-		if (err < 0) {
-			y0 += ystep;
-			err += dx;
-		}
-	}
+void Canvas::writeLine(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color) {
+	if (clipDamage(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1), std::max(y0, y1)) == CLIP_OUTSIDE)
+		return;
+	Sink sink = { *this };
+	prim::line(sink, x0, y0, x1, y1, color);
 }
 
 // (x,y) is topmost point; if unsure, calling function
 // should sort endpoints or call writeLine() instead
 void Canvas::writeVLine(coord_t x0, coord_t y0, coord_t y1, color_t color) {
-	for (int16_t y = y0; y <= y1; y++) {
+	if (x0 < clip.x0 || x0 > clip.x1)
+		return;
+	if (y0 < clip.y0)
+		y0 = clip.y0;
+	if (y1 > clip.y1)
+		y1 = clip.y1;
+	damageRect(x0, y0, x0, y1);
+	for (coord_t y = y0; y <= y1; y++) {
 		writePixel(x0, y, color);
 	}
 }
@@ -386,7 +530,14 @@ void Canvas::writeVLine(coord_t x0, coord_t y0, coord_t y1, color_t color) {
 // (x,y) is leftmost point; if unsure, calling function
 // should sort endpoints or call writeLine() instead
 void Canvas::writeHLine(coord_t x0, coord_t y0, coord_t x1, color_t color) {
-	for (int16_t x = x0; x <= x1; x++) {
+	if (y0 < clip.y0 || y0 > clip.y1)
+		return;
+	if (x0 < clip.x0)
+		x0 = clip.x0;
+	if (x1 > clip.x1)
+		x1 = clip.x1;
+	damageRect(x0, y0, x1, y0);
+	for (coord_t x = x0; x <= x1; x++) {
 		writePixel(x, y0, color);
 	}
 }
@@ -400,22 +551,35 @@ void Canvas::fillRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1) {
 	sortCoords(rx0, rx1);
 	sortCoords(ry0, ry1);
 
-	for (int16_t y = ry0; y <= ry1; y++) {
-		writeHLine(rx0, y, rx1, colors.draw);
+	writeFillRect(rx0, ry0, rx1, ry1, colors.draw);
+}
+
+void Canvas::writeSpans(const span_t *spans, size_t n, color_t color) {
+	for (size_t i = 0; i < n; i++) {
+		writeHLine(spans[i].x0, spans[i].y, spans[i].x1, color);
 	}
 }
 
+void Canvas::writeFillRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color) {
+	if (y0 < clip.y0)
+		y0 = clip.y0;
+	if (y1 > clip.y1)
+		y1 = clip.y1;
+	Sink sink = { *this };
+	prim::SpanBatch<Sink> batch(sink);
+	batch.rect(x0, y0, x1, y1, color);
+}
+
 void Canvas::clearScreen() {
-	for (int y = 0; y < HEIGHT; y++) {
-		writeHLine(0, y, WIDTH - 1, colors.drawbg);
-	}
+	writeFillRect(0, 0, WIDTH - 1, HEIGHT - 1, colors.drawbg);
 }
 
 void Canvas::drawPixel(coord_t x, coord_t y) {
 	coord_t rx = realX(x, y);
 	coord_t ry = realY(x, y);
 
-	writePixel(rx, ry, colors.draw);
+	if (clipTest(rx, ry, rx, ry) == CLIP_INSIDE)
+		writePixel(rx, ry, colors.draw);
 }
 
 void Canvas::drawLine(coord_t x0, coord_t y0, coord_t x1, coord_t y1) {
@@ -425,10 +589,10 @@ void Canvas::drawLine(coord_t x0, coord_t y0, coord_t x1, coord_t y1) {
 	coord_t ry1 = realY(x1, y1);
 
 	if (rx0 == rx1) {
-		sortCoords(y0, y1);
+		sortCoords(ry0, ry1);
 		writeVLine(rx0, ry0, ry1, colors.draw);
 	} else if (ry0 == ry1) {
-		sortCoords(x0, x1);
+		sortCoords(rx0, rx1);
 		writeHLine(rx0, ry0, rx1, colors.draw);
 	} else {
 		writeLine(rx0, ry0, rx1, ry1, colors.draw);
@@ -443,7 +607,6 @@ void Canvas::drawTriangle(coord_t x0, coord_t y0, coord_t x1, coord_t y1, coord_
 
 // Fill a triangle
 void Canvas::fillTriangle(coord_t x0, coord_t y0, coord_t x1, coord_t y1, coord_t x2, coord_t y2) {
-
 	coord_t rx0 = realX(x0, y0);
 	coord_t ry0 = realY(x0, y0);
 	coord_t rx1 = realX(x1, y1);
@@ -451,87 +614,15 @@ void Canvas::fillTriangle(coord_t x0, coord_t y0, coord_t x1, coord_t y1, coord_
 	coord_t rx2 = realX(x2, y2);
 	coord_t ry2 = realY(x2, y2);
 
-	//coord_t a, b, y, last;
-
-    // Sort coordinates by Y order (y2 >= y1 >= y0)
-    if (ry0 > ry1) {
-    	swapCoords(ry0, ry1); swapCoords(rx0, rx1);
-    }
-    if (ry1 > ry2) {
-    	swapCoords(ry2, ry1); swapCoords(rx2, rx1);
-    }
-    if (ry0 > ry1) {
-    	swapCoords(ry0, ry1); swapCoords(rx0, rx1);
-    }
-
-    if(ry0 == ry2) { // Handle awkward all-on-same-line case as its own thing
-        coord_t a = rx0;
-        coord_t b = rx0;
-        if(rx1 < a)
-        	a = rx1;
-        else if(rx1 > b)
-        	b = rx1;
-        if(rx2 < a)
-        	a = rx2;
-        else if(rx2 > b)
-        	b = rx2;
-        writeHLine(a, ry0, b, colors.draw);
-        return;
-    }
-
-    coord_t dx01 = rx1 - rx0;
-    coord_t dy01 = ry1 - ry0;
-	coord_t dx02 = rx2 - rx0;
-	coord_t dy02 = ry2 - ry0;
-	coord_t dx12 = rx2 - rx1;
-	coord_t dy12 = ry2 - ry1;
-	coord_t sa   = 0;
-	coord_t sb   = 0;
-
-    // For upper part of triangle, find scanline crossings for segments
-    // 0-1 and 0-2.  If y1=y2 (flat-bottomed triangle), the scanline y1
-    // is included here (and second loop will be skipped, avoiding a /0
-    // error there), otherwise scanline y1 is skipped here and handled
-    // in the second loop...which also avoids a /0 error here if y0=y1
-    // (flat-topped triangle).
-	coord_t last;
-    if(ry1 == ry2)
-    	last = ry1;   // Include y1 scanline
-    else
-    	last = ry1-1; // Skip it
-
-    coord_t y=ry0;
-    for(; y<=last; y++) {
-        coord_t a   = rx0 + sa / dy01;
-        coord_t b   = rx0 + sb / dy02;
-        sa += dx01;
-        sb += dx02;
-        /* longhand:
-        a = x0 + (x1 - x0) * (y - y0) / (y1 - y0);
-        b = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
-        */
-        if (a > b)
-        	swapCoords(a, b);
-        writeHLine(a, y, b, colors.draw);
-    }
-
-    // For lower part of triangle, find scanline crossings for segments
-    // 0-2 and 1-2.  This loop is skipped if y1=y2.
-    sa = dx12 * (y - ry1);
-    sb = dx02 * (y - ry0);
-    for(; y<=ry2; y++) {
-    	coord_t a   = rx1 + sa / dy12;
-    	coord_t b   = rx0 + sb / dy02;
-        sa += dx12;
-        sb += dx02;
-        /* longhand:
-        a = x1 + (x2 - x1) * (y - y1) / (y2 - y1);
-        b = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
-        */
-        if (a > b)
-        	swapCoords(a, b);
-        writeHLine(a, y, b, colors.draw);
-    }
+	writeFillTriangle(rx0, ry0, rx1, ry1, rx2, ry2, colors.draw);
+}
+
+void Canvas::writeFillTriangle(coord_t x0, coord_t y0, coord_t x1, coord_t y1, coord_t x2, coord_t y2, color_t color) {
+	if (clipDamage(std::min(x0, std::min(x1, x2)), std::min(y0, std::min(y1, y2)),
+			std::max(x0, std::max(x1, x2)), std::max(y0, std::max(y1, y2))) == CLIP_OUTSIDE)
+		return;
+	Sink sink = { *this };
+	prim::fillTriangle(sink, x0, y0, x1, y1, x2, y2, color);
 }
 
 // Draw a circle outline
@@ -539,70 +630,15 @@ void Canvas::drawCircle(coord_t x0, coord_t y0, coord_t r) {
 	coord_t rx0 = realX(x0, y0);
 	coord_t ry0 = realY(x0, y0);
 
-	drawCircleHelper(rx0, ry0, r, 0, 0);
-
-//    int16_t f = 1 - r;
-//    int16_t ddF_x = 1;
-//    int16_t ddF_y = -2 * r;
-//    int16_t x = 0;
-//    int16_t y = r;
-//
-//    writePixel(rx0  , ry0+r, color);
-//    writePixel(rx0  , ry0-r, color);
-//    writePixel(rx0+r, ry0  , color);
-//    writePixel(rx0-r, ry0  , color);
-//
-//    while (x<y) {
-//        if (f >= 0) {
-//            y--;
-//            ddF_y += 2;
-//            f += ddF_y;
-//        }
-//        x++;
-//        ddF_x += 2;
-//        f += ddF_x;
-//
-//        writePixel(rx0 + x, ry0 + y, color);
-//        writePixel(rx0 - x, ry0 + y, color);
-//        writePixel(rx0 + x, ry0 - y, color);
-//        writePixel(rx0 - x, ry0 - y, color);
-//        writePixel(rx0 + y, ry0 + x, color);
-//        writePixel(rx0 - y, ry0 + x, color);
-//        writePixel(rx0 + y, ry0 - x, color);
-//        writePixel(rx0 - y, ry0 - x, color);
-//    }
-}
-
-void Canvas::drawCircleHelper(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY) {
-	int16_t f = 1 - r;
-	int16_t ddF_x = 1;
-	int16_t ddF_y = -2 * r;
-	int16_t x = 0;
-	int16_t y = r;
-
-	writePixel(x0 + y + deltaX, y0 + x + deltaY, colors.draw);
-	writePixel(x0 + x + deltaX, y0 - y, colors.draw);
-	writePixel(x0 - x, y0 + y + deltaY, colors.draw);
-	writePixel(x0 - y, y0 - x, colors.draw);
-
-	while (x < y) {
-		if (f >= 0) {
-			y--;
-			ddF_y += 2;
-			f += ddF_y;
-		}
-		x++;
-		ddF_x += 2;
-		f += ddF_x;
-		writePixel(x0 + x + deltaX, y0 + y + deltaY, colors.draw);
-		writePixel(x0 + y + deltaX, y0 + x + deltaY, colors.draw);
-		writePixel(x0 + x + deltaX, y0 - y, colors.draw);
-		writePixel(x0 + y + deltaX, y0 - x, colors.draw);
-		writePixel(x0 - x, y0 + y + deltaY, colors.draw);
-		writePixel(x0 - y, y0 + x + deltaY, colors.draw);
-		writePixel(x0 - x, y0 - y, colors.draw);
-		writePixel(x0 - y, y0 - x, colors.draw);
-	}
+	writeCircle(rx0, ry0, r, 0, 0, colors.draw);
+}
+
+void Canvas::writeCircle(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY, color_t color) {
+	if (clipDamage(x0 - r + std::min(deltaX, 0), y0 - r + std::min(deltaY, 0),
+			x0 + r + std::max(deltaX, 0), y0 + r + std::max(deltaY, 0)) == CLIP_OUTSIDE)
+		return;
+	Sink sink = { *this };
+	prim::circle(sink, x0, y0, r, deltaX, deltaY, color);
 }
 
 void Canvas::fillCircle(coord_t x0, coord_t y0, coord_t r) {
@@ -610,33 +646,15 @@ void Canvas::fillCircle(coord_t x0, coord_t y0, coord_t r) {
 	coord_t ry0 = realY(x0, y0);
 
 	writeHLine(rx0 - r, ry0, rx0 + r, colors.draw);
-	fillCircleHelper(rx0, ry0, r, 0, 0);
+	writeFillCircle(rx0, ry0, r, 0, 0, colors.draw);
 }
 
-// Used to do circles and roundrects
-void Canvas::fillCircleHelper(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY) {
-
-	int16_t f = 1 - r;
-	int16_t ddF_x = 1;
-	int16_t ddF_y = -2 * r;
-	int16_t x = 0;
-	int16_t y = r;
-
-	while (x < y) {
-		if (f >= 0) {
-			y--;
-			ddF_y += 2;
-			f += ddF_y;
-		}
-		x++;
-		ddF_x += 2;
-		f += ddF_x;
-
-		writeHLine(x0 - x, y0 + y + deltaY, x0 + x + deltaX, colors.draw);
-		writeHLine(x0 - y, y0 + x + deltaY, x0 + y + deltaX, colors.draw);
-		writeHLine(x0 - x, y0 - y, x0 + x + deltaX, colors.draw);
-		writeHLine(x0 - y, y0 - x, x0 + y + deltaX, colors.draw);
-	}
+void Canvas::writeFillCircle(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY, color_t color) {
+	if (clipDamage(x0 - r + std::min(deltaX, 0), y0 - r + std::min(deltaY, 0),
+			x0 + r + std::max(deltaX, 0), y0 + r + std::max(deltaY, 0)) == CLIP_OUTSIDE)
+		return;
+	Sink sink = { *this };
+	prim::fillCircle(sink, x0, y0, r, deltaX, deltaY, color);
 }
 
 // Draw a rectangle
@@ -672,7 +690,7 @@ void Canvas::drawRoundRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, coord
 	writeVLine(rx1, ry0 + r, ry1 - r - 1, colors.draw); // Right
 
 	// draw four corners
-	drawCircleHelper(rx0 + r, ry0 + r, r, rx1 - rx0 - 2 * r, ry1 - ry0 - 2 * r);
+	writeCircle(rx0 + r, ry0 + r, r, rx1 - rx0 - 2 * r, ry1 - ry0 - 2 * r, colors.draw);
 }
 
 // Fill a rounded rectangle
@@ -685,12 +703,10 @@ void Canvas::fillRoundRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, coord
 	sortCoords(rx0, rx1);
 	sortCoords(ry0, ry1);
 
-	for (int16_t y = ry0 + r; y <= ry1 - r; y++) {
-		writeHLine(rx0, y, rx1, colors.draw);
-	}
+	writeFillRect(rx0, ry0 + r, rx1, ry1 - r, colors.draw);
 
 	// draw four corners
-	fillCircleHelper(rx0 + r, ry0 + r, r, rx1 - rx0 - 2 * r, ry1 - ry0 - 2 * r);
+	writeFillCircle(rx0 + r, ry0 + r, r, rx1 - rx0 - 2 * r, ry1 - ry0 - 2 * r, colors.draw);
 }
 
 // BITMAP / XBITMAP / GRAYSCALE / RGB BITMAP FUNCTIONS ---------------------
@@ -698,20 +714,8 @@ void Canvas::fillRoundRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, coord
 // Draw a RAM-resident 1-bit image at the specified (x,y) position,
 // using the specified foreground color (unset bits are transparent).
 void Canvas::drawBitmap(coord_t x, coord_t y, const uint8_t *bitmap, coord_t w, coord_t h) {
-	//TODO draw all pixels
-	int16_t byteWidth = (w + 7) / 8; // Bitmap scanline pad = whole byte
-	uint8_t byte = 0;
-
-	for (int16_t j = 0; j < h; j++, y++) {
-		for (int16_t i = 0; i < w; i++) {
-			if (i & 7)
-				byte <<= 1;
-			else
-				byte = bitmap[j * byteWidth + i / 8];
-			if (byte & 0x80)
-				writePixel(x + i, y, colors.draw);
-		}
-	}
+	size_t stride = (w + 7) & ~7; // Bitmap scanline pad = whole byte
+	writeBitmap(realX(x, y), realY(x, y), bitmap, stride, w, h, 1, colors.draw, colors.drawbg, false);
 }
 
 // Draw a RAM-resident 1-bit image at the specified (x,y) position,
@@ -719,17 +723,138 @@ void Canvas::drawBitmap(coord_t x, coord_t y, const uint8_t *bitmap, coord_t w,
 // bits) colors.
 void Canvas::drawBitmap(coord_t x, coord_t y, const uint8_t *bitmap, const uint8_t *mask, coord_t w, coord_t h) {
 	//TODO use mask
-	int16_t byteWidth = (w + 7) / 8; // Bitmap scanline pad = whole byte
-	uint8_t byte = 0;
+	size_t stride = (w + 7) & ~7; // Bitmap scanline pad = whole byte
+	writeBitmap(realX(x, y), realY(x, y), bitmap, stride, w, h, 1, colors.draw, colors.drawbg, true);
+}
 
-	for (int16_t j = 0; j < h; j++, y++) {
-		for (int16_t i = 0; i < w; i++) {
-			if (i & 7)
-				byte <<= 1;
-			else
-				byte = bitmap[j * byteWidth + i / 8];
-			writePixel(x + i, y, (byte & 0x80) ? colors.draw : colors.drawbg);
+void Canvas::writeBitmap(coord_t x, coord_t y, const uint8_t *bitmap, size_t stride,
+		coord_t w, coord_t h, coord_t size, color_t color, color_t bg, bool opaque) {
+	if (clipDamage(bitmapBounds(x, y, w, h, size)) == CLIP_OUTSIDE)
+		return;
+	Sink sink = { *this };
+	prim::bitmap(sink, x, y, mrot, bitmap, stride, w, h, size, color, bg, opaque);
+}
+
+color_t Canvas::mixColor(color_t dst, color_t src, unsigned a, unsigned max) {
+	return 2 * a >= max ? src : dst;
+}
+
+void Canvas::writeGlyph(coord_t x, coord_t y, const void *font, uint32_t code,
+		const uint8_t *bitmap, size_t stride, unsigned bpp, coord_t w, coord_t h, coord_t size,
+		color_t color, color_t bg, bool opaque) {
+	if (clipDamage(bitmapBounds(x, y, w, h, size)) == CLIP_OUTSIDE)
+		return;
+	const std::vector<run_t> &runs = glyphRuns(font, code, bitmap, stride, bpp, w, h);
+	Sink sink = { *this };
+	if (bpp > 1) {
+		// no blending here, transparent text keeps the levels of at
+		// least half coverage
+		unsigned max = (1 << bpp) - 1;
+		color_t ramp[16];
+		if (opaque)
+			textRamp(ramp, max, color, bg);
+		else
+			std::fill(ramp, ramp + max + 1, color);
+		prim::levels<false>(sink, x, y, mrot, runs.data(), runs.size(), size,
+				ramp, (max + 1) / 2, max, opaque);
+		return;
+	}
+	prim::runs(sink, x, y, mrot, runs.data(), runs.size(), size, color, bg, opaque);
+}
+
+// NOTE: THERE IS NO 'BACKGROUND' COLOR OPTION ON CUSTOM FONTS.
+// THIS IS ON PURPOSE AND BY DESIGN.  The background color feature
+// has typically been used with the 'classic' font to overwrite old
+// screen contents with new data.  This ONLY works because the
+// characters are a uniform size; it's not a sensible thing to do with
+// proportionally-spaced fonts with glyphs of varying sizes (and that
+// may overlap).  Callers pass opaque only for the classic font.  To
+// replace previously-drawn text when using a custom font, setTextFill()
+// composites the glyphs onto the font-high line box instead, see
+// writeTextBoxes().
+void Canvas::writeGlyphs(const glyph_t *glyphs, size_t n, const rect_t &bounds,
+		coord_t size, color_t color, color_t bg, bool opaque) {
+	if (clipTest(bounds) == CLIP_OUTSIDE)
+		return;
+	for (size_t i = 0; i < n; i++) {
+		const glyph_t &g = glyphs[i];
+		writeGlyph(g.x, g.y, g.font, g.code, g.bitmap, g.stride, g.bpp, g.w, g.h, size, color, bg, opaque);
+	}
+}
+
+// Marks the pixels of glyph runs in a byte mask covering the rect r with
+// their coverage level, the 'color' of the runs.  Overlapping glyphs keep
+// the higher level.
+struct MaskSink {
+	uint8_t *mask;
+	rect_t r;
+
+	void rect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t level) {
+		x0 = std::max(x0, r.x0);
+		y0 = std::max(y0, r.y0);
+		x1 = std::min(x1, r.x1);
+		y1 = std::min(y1, r.y1);
+		size_t w = r.x1 - r.x0 + 1;
+		for (coord_t y = y0; y <= y1; y++) {
+			uint8_t *m = mask + (y - r.y0) * w;
+			for (coord_t x = x0; x <= x1; x++)
+				m[x - r.x0] = std::max(m[x - r.x0], (uint8_t) level);
+		}
+	}
+};
+
+static const color_t levelRamp[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+
+void Canvas::writeTextBoxes(const glyph_t *glyphs, size_t n, const rect_t *boxes, size_t nboxes,
+		coord_t size, color_t color, color_t bg) {
+	for (size_t i = 0; i < nboxes; i++) {
+		rect_t r;
+		r.x0 = std::max(boxes[i].x0, clip.x0);
+		r.y0 = std::max(boxes[i].y0, clip.y0);
+		r.x1 = std::min(boxes[i].x1, clip.x1);
+		r.y1 = std::min(boxes[i].y1, clip.y1);
+		if (r.x0 > r.x1 || r.y0 > r.y1)
+			continue;
+
+		// composite the glyphs touching the box into a mask of it
+		size_t w = r.x1 - r.x0 + 1;
+		textMask.assign(w * (r.y1 - r.y0 + 1), 0);
+		MaskSink ms = { textMask.data(), r };
+		unsigned max = 1;
+		for (size_t j = 0; j < n; j++) {
+			const glyph_t &g = glyphs[j];
+			rect_t b = bitmapBounds(g.x, g.y, g.w, g.h, size);
+			if (b.x1 < r.x0 || b.y1 < r.y0 || b.x0 > r.x1 || b.y0 > r.y1)
+				continue;
+			const std::vector<run_t> &runs = glyphRuns(g.font, g.code, g.bitmap, g.stride, g.bpp, g.w, g.h);
+			if (g.bpp > 1) {
+				max = (1 << g.bpp) - 1;
+				prim::levels<false>(ms, g.x, g.y, mrot, runs.data(), runs.size(), size,
+						levelRamp, 1, max, false);
+			} else {
+				prim::runs(ms, g.x, g.y, mrot, runs.data(), runs.size(), size, 1, 0, false);
+			}
+		}
+
+		// and write every row as spans of each level, from background to
+		// glyph pixels
+		for (unsigned a = 0; a <= max; a++)
+			textSpans[a].clear();
+		const uint8_t *m = textMask.data();
+		for (coord_t y = r.y0; y <= r.y1; y++, m += w) {
+			size_t start = 0;
+			for (size_t x = 1; x <= w; x++) {
+				if (x == w || m[x] != m[start]) {
+					span_t sp = { y, (coord_t)(r.x0 + start), (coord_t)(r.x0 + x - 1) };
+					textSpans[m[start]].push_back(sp);
+					start = x;
+				}
+			}
 		}
+		color_t ramp[16];
+		textRamp(ramp, max, color, bg);
+		for (unsigned a = 0; a <= max; a++)
+			writeSpans(textSpans[a].data(), textSpans[a].size(), ramp[a]);
 	}
 }
 
@@ -737,9 +862,10 @@ void Canvas::drawBitmap(coord_t x, coord_t y, const uint8_t *bitmap, const uint8
 // pos.  Specifically for 8-bit display devices such as IS31FL3731;
 // no color reduction/expansion is performed.
 void Canvas::drawGrayscaleImage(coord_t x, coord_t y, const uint8_t *bitmap, coord_t w, coord_t h) {
-	for (int16_t j = 0; j < h; j++, y++) {
-		for (int16_t i = 0; i < w; i++) {
-			writePixel(x + i, y, bitmap[j * w + i]);
+	Sink sink = { *this }; // clips
+	for (coord_t j = 0; j < h; j++, y++) {
+		for (coord_t i = 0; i < w; i++) {
+			sink.pixel(x + i, y, bitmap[(size_t) j * w + i]);
 		}
 	}
 }
@@ -750,17 +876,18 @@ void Canvas::drawGrayscaleImage(coord_t x, coord_t y, const uint8_t *bitmap, coo
 // match.  Specifically for 8-bit display devices such as IS31FL3731;
 // no color reduction/expansion is performed.
 void Canvas::drawGrayscaleImage(coord_t x, coord_t y, const uint8_t *bitmap, const uint8_t *mask, coord_t w, coord_t h) {
+	Sink sink = { *this }; // clips
 	//TODO draw all pixels
-	int16_t bw = (w + 7) / 8; // Bitmask scanline pad = whole byte
+	size_t bw = (w + 7) / 8; // Bitmask scanline pad = whole byte
 	uint8_t byte = 0;
-	for (int16_t j = 0; j < h; j++, y++) {
-		for (int16_t i = 0; i < w; i++) {
+	for (coord_t j = 0; j < h; j++, y++) {
+		for (coord_t i = 0; i < w; i++) {
 			if (i & 7)
 				byte <<= 1;
 			else
 				byte = mask[j * bw + i / 8];
 			if (byte & 0x80) {
-				writePixel(x + i, y, bitmap[j * w + i]);
+				sink.pixel(x + i, y, bitmap[(size_t) j * w + i]);
 			}
 		}
 	}
@@ -769,9 +896,10 @@ void Canvas::drawGrayscaleImage(coord_t x, coord_t y, const uint8_t *bitmap, con
 // Draw a RAM-resident 16-bit image (RGB 5/6/5) at the specified (x,y)
 // position.  For 16-bit display devices; no color reduction performed.
 void Canvas::drawRGBImage(coord_t x, coord_t y, const uint32_t *bitmap, coord_t w, coord_t h) {
-	for (int16_t j = 0; j < h; j++, y++) {
-		for (int16_t i = 0; i < w; i++) {
-			writePixel(x + i, y, bitmap[j * w + i]);
+	Sink sink = { *this }; // clips
+	for (coord_t j = 0; j < h; j++, y++) {
+		for (coord_t i = 0; i < w; i++) {
+			sink.pixel(x + i, y, bitmap[(size_t) j * w + i]);
 		}
 	}
 }
@@ -781,17 +909,18 @@ void Canvas::drawRGBImage(coord_t x, coord_t y, const uint32_t *bitmap, coord_t
 // BOTH buffers (color and mask) must be RAM-resident, no mix-and-match.
 // For 16-bit display devices; no color reduction performed.
 void Canvas::drawRGBImage(coord_t x, coord_t y, const uint32_t *bitmap, const uint8_t *mask, coord_t w, coord_t h) {
+	Sink sink = { *this }; // clips
 	//TODO use mask
-	int16_t bw = (w + 7) / 8; // Bitmask scanline pad = whole byte
+	size_t bw = (w + 7) / 8; // Bitmask scanline pad = whole byte
 	uint8_t byte = 0;
-	for (int16_t j = 0; j < h; j++, y++) {
-		for (int16_t i = 0; i < w; i++) {
+	for (coord_t j = 0; j < h; j++, y++) {
+		for (coord_t i = 0; i < w; i++) {
 			if (i & 7)
 				byte <<= 1;
 			else
 				byte = mask[j * bw + i / 8];
 			if (byte & 0x80) {
-				writePixel(x + i, y, bitmap[j * w + i]);
+				sink.pixel(x + i, y, bitmap[(size_t) j * w + i]);
 			}
 		}
 	}
@@ -800,149 +929,379 @@ void Canvas::drawRGBImage(coord_t x, coord_t y, const uint32_t *bitmap, const ui
 // TEXT- AND CHARACTER-HANDLING FUNCTIONS ----------------------------------
 
 // Draw a character
-void Canvas::drawChar(coord_t x, coord_t y, unsigned char c, coord_t size) {
-	ColorSafe tmp(*this);
+// Row-major 6x8 bitmaps of the column-major 5x8 glcdfont characters, the
+// 6th column is the spacing drawn with the background if opaque.
+static const uint8_t *glcdBitmap(unsigned char c) {
+	struct Table {
+		uint8_t rows[256][8];
+		Table() {
+			for (int ch = 0; ch < 256; ch++) {
+				for (int8_t j = 0; j < 8; j++) {
+					uint8_t row = 0;
+					for (int8_t i = 0; i < 5; i++) {
+						row |= ((glcdfont[ch * 5 + i] >> j) & 1) << (7 - i);
+					}
+					rows[ch][j] = row;
+				}
+			}
+		}
+	};
+	static const Table table;
+	return table.rows[c];
+}
 
+void Canvas::drawChar(coord_t x, coord_t y, unsigned char c, coord_t size) {
 	bool opaque = (colors.text != colors.textbg);
+	coord_t rx = realX(x, y);
+	coord_t ry = realY(x, y);
 
-	if ((x >= _width) || // Clip right
-			(y >= _height) || // Clip bottom
-			((x + 6 * size - 1) < 0) || // Clip left
-			((y + 8 * size - 1) < 0))   // Clip top
+	if (clipTest(bitmapBounds(rx, ry, 6, 8, size)) == CLIP_OUTSIDE)
 		return;
 
-	for (int8_t i = 0; i < 5; i++) { // Char bitmap = 5 columns
-		uint8_t line = glcdfont[c * 5 + i];
-		for (int8_t j = 0; j < 8; j++, line >>= 1) {
-			bool draw = line & 1;
-			colors.draw = draw ? colors.text : colors.textbg;
-			if (opaque || draw) {
-				if (size == 1) {
-					drawPixel(x + i, y + j);
-				} else {
-					int16_t xp = x + i * size;
-					int16_t yp = y + i * size;
-					fillRect(xp, yp, xp + size - 1, yp + size - 1);
-				}
-			}
+	writeGlyph(rx, ry, NULL, c, glcdBitmap(c), 8, 1, 6, 8, size, colors.text, colors.textbg, opaque);
+}
+
+// Characters of the next byte of a string: code points decoded by dec,
+// or the byte itself without a decoder
+static inline int nextChars(Utf8Decoder *dec, char b, uint32_t cps[2]) {
+	if (dec)
+		return dec->feed((uint8_t) b, cps);
+	cps[0] = (uint8_t) b;
+	return 1;
+}
+
+bool Canvas::placeChar(uint32_t c, coord_t &x, coord_t &y, coord_t limit, glyph_t &g, uint32_t &prev) const {
+	if (!customFont()) { // 'Classic' built-in font
+
+		if (c == '\n') {                        // Newline?
+			x = 0;                            // Reset x to zero,
+			y += textheight * 8;                 // advance y one line
+			return false;
+		} else if (c == '\r') {
+			x = 0;                            // Reset x to zero,
+			return false;
 		}
-	}
-	if (opaque) { // If opaque, draw vertical line for last column
-		colors.draw = colors.textbg;
-		if (size == 1) {
-			drawLine(x + 5, y, x + 6 - 1, y + 8 - 1);
+		if (limit > 0 && ((x + textheight * 6) > limit)) { // Off right?
+			x = 0;                        // Reset x to zero,
+			y += textheight * 8;             // advance y one line
+		}
+		g.x = x;
+		g.y = y;
+		g.font = NULL;
+		g.code = c & 0xFF;
+		g.bitmap = glcdBitmap(c & 0xFF);
+		g.stride = 8;
+		g.w = 6;
+		g.h = 8;
+		g.bpp = 1;
+		x += textheight * 6;                 // Advance x one char
+		return true;
+
+	} else { // Custom font
+
+		if (c == '\n') {
+			x = 0;
+			y += textheight * fontYAdvance();
+			prev = 0;
+			return false;
+		} else if (c == '\r') {
+			x = 0;
+			prev = 0;
+			return false;
+		}
+		coord_t w, h, xa, xo, yo;
+		if (gfxFont) {
+			if ((c < gfxFont->first) || (c > gfxFont->last))
+				return false;
+			const GFXglyph *glyph = gfxFont->glyph + c - gfxFont->first;
+			w = glyph->width;
+			h = glyph->height;
+			xa = glyph->xAdvance;
+			xo = glyph->xOffset;
+			yo = glyph->yOffset;
+			g.font = gfxFont;
+			g.code = glyph - gfxFont->glyph;
+			g.bitmap = gfxFont->bitmap + glyph->bitmapOffset;
+			g.bpp = 1;
 		} else {
-			fillRect(x + 5 * size, y, x + 6 * size - 1, y + 8 * size - 1);
+			const GFXglyph2 *glyph = gfxFont2Glyph(gfxFont2, c);
+			if (!glyph) {
+				prev = 0;
+				return false;
+			}
+			uint16_t number = glyph - gfxFont2->glyph;
+			if (prev)
+				x += gfxFont2Kerning(gfxFont2, prev - 1, number) * textheight;
+			prev = number + 1;
+			w = glyph->width;
+			h = glyph->height;
+			xa = glyph->xAdvance;
+			xo = glyph->xOffset;
+			yo = glyph->yOffset;
+			g.font = gfxFont2;
+			g.code = glyph - gfxFont2->glyph;
+			g.bitmap = gfxFont2->bitmap + glyph->bitmapOffset;
+			g.bpp = gfxFont2->bpp > 1 ? gfxFont2->bpp : 1;
+		}
+		coord_t advance = xa * textheight;
+		if ((w == 0) || (h == 0)) { // No associated bitmap
+			x += advance;
+			return false;
+		}
+		if (limit > 0 && ((x + textheight * (xo + w)) > limit)) {
+			x = 0; // no kerning at the start of a line
+			y += textheight * fontYAdvance();
 		}
+		g.x = x + xo * textheight;
+		g.y = y + yo * textheight;
+		// Glyph bitmaps are fully packed, rows are 'w' pixels apart,
+		// unless the font is repacked
+		g.stride = w;
+		if (preparedFont) {
+			g.bitmap = preparedFont->getBitmap(g.code);
+			g.stride = preparedFont->getStride(w);
+		}
+		g.w = w;
+		g.h = h;
+		x += advance;
+		return true;
+
 	}
 }
 
-void Canvas::drawGlyph(coord_t x, coord_t y, GFXglyph *glyph, coord_t size) {
-	ColorSafe tmp(*this);
-
-	// Character is assumed previously filtered by write() to eliminate
-	// newlines, returns, non-printable characters, etc.  Calling
-	// drawChar() directly with 'bad' characters of font may cause mayhem!
-
-	uint32_t bo = glyph->bitmapOffset;
-	coord_t xs = glyph->xOffset, ys = glyph->yOffset;
-	coord_t xe = xs + glyph->width, ye = ys + glyph->height;
-	uint8_t bits = 0, bit = 0;
-
-	// Todo: Add character clipping here
-
-	// NOTE: THERE IS NO 'BACKGROUND' COLOR OPTION ON CUSTOM FONTS.
-	// THIS IS ON PURPOSE AND BY DESIGN.  The background color feature
-	// has typically been used with the 'classic' font to overwrite old
-	// screen contents with new data.  This ONLY works because the
-	// characters are a uniform size; it's not a sensible thing to do with
-	// proportionally-spaced fonts with glyphs of varying sizes (and that
-	// may overlap).  To replace previously-drawn text when using a custom
-	// font, use the getTextBounds() function to determine the smallest
-	// rectangle encompassing a string, erase the area with fillRect(),
-	// then draw new text.  This WILL infortunately 'blink' the text, but
-	// is unavoidable.  Drawing 'background' pixels will NOT fix this,
-	// only creates a new set of problems.  Have an idea to work around
-	// this (a canvas object type for MCUs that can afford the RAM and
-	// displays supporting setAddrWindow() and pushColors()), but haven't
-	// implemented this yet.
-
-	colors.draw = colors.text;
-
-	printf("drawing %d\n", glyph->bitmapOffset);
-
-	uint8_t *bitmap = gfxFont->bitmap;
-	for (coord_t yy = ys; yy < ye; yy++) {
-		for (coord_t xx = xs; xx < xe; xx++) {
-			if (!(bit++ & 7)) {
-				bits = bitmap[bo++];
+// Logical background boxes of the lines of custom font text: over the
+// pen movement and the glyphs of a line, from the top to the bottom of
+// the font.  One box per line, empty ones have x1 < x0.
+class LineBoxes {
+public:
+	LineBoxes(std::vector<rect_t> &boxes, coord_t top, coord_t bottom, coord_t size) :
+			boxes(boxes), top(top), bottom(bottom), size(size) {
+		boxes.clear();
+	}
+
+	// new line with the pen at (x,y), y is the baseline
+	void start(coord_t x, coord_t y) {
+		b.x0 = b.x1 = x;
+		b.y0 = y + top;
+		b.y1 = y + bottom;
+	}
+	void pen(coord_t x) {
+		b.x0 = std::min(b.x0, x);
+		b.x1 = std::max(b.x1, x);
+	}
+	void glyph(const glyph_t &g) {
+		pen(g.x);
+		pen(g.x + g.w * size);
+		b.y0 = std::min(b.y0, g.y);
+		b.y1 = std::max(b.y1, (coord_t)(g.y + g.h * size));
+	}
+	void finish() {
+		// the right and bottom edges are exclusive so far
+		rect_t r = { b.x0, b.y0, (coord_t)(b.x1 - 1), (coord_t)(b.y1 - 1) };
+		boxes.push_back(r);
+	}
+
+private:
+	std::vector<rect_t> &boxes;
+	coord_t top, bottom, size;
+	rect_t b;
+};
+
+// Lay out the string once in device coordinates, the glyphs are then
+// clipped and drawn as one batch by writeGlyphs()
+void Canvas::layoutText(const char *str, size_t len, std::vector<glyph_t> &glyphs, rect_t &bounds,
+		std::vector<rect_t> *boxes) {
+	glyphs.clear();
+	std::vector<rect_t> none;
+	LineBoxes lines(boxes ? *boxes : none, fontTop * textheight, fontBottom * textheight, textheight);
+	lines.start(cursor_x, cursor_y);
+	Utf8Decoder *dec = customFont() ? &utf8 : NULL;
+	for (size_t i = 0; i < len; i++) {
+		uint32_t cps[2];
+		int n = nextChars(dec, str[i], cps);
+		for (int k = 0; k < n; k++) {
+			coord_t px = cursor_x, py = cursor_y;
+			glyph_t g;
+			bool placed = placeChar(cps[k], cursor_x, cursor_y, wrap ? _width : 0, g, kernPrev);
+			if (boxes && cursor_y != py) {
+				lines.pen(px);
+				lines.finish();
+				lines.start(0, cursor_y);
 			}
-			if (bits & 0x80) {
-				if (size == 1) {
-					drawPixel(x + xx, y + yy);
-				} else {
-					fillRect(x + xx * size, y + yy * size, x + (xx + 1) * size - 1, y + (yy + 1) * size - 1);
-				}
+			if (boxes) {
+				lines.pen(cursor_x);
+				if (placed)
+					lines.glyph(g);
 			}
-			bits <<= 1;
+			if (!placed)
+				continue;
+			coord_t rx = realX(g.x, g.y);
+			g.y = realY(g.x, g.y);
+			g.x = rx;
+			rect_t b = bitmapBounds(g.x, g.y, g.w, g.h, textheight);
+			bounds = glyphs.empty() ? b : unite(bounds, b);
+			glyphs.push_back(g);
 		}
 	}
+	if (boxes) {
+		lines.finish();
+		for (size_t i = 0; i < boxes->size(); i++)
+			(*boxes)[i] = deviceRect((*boxes)[i]);
+	}
 }
 
 void Canvas::write(const char *data, size_t len) {
-	for (size_t i = 0; i < len; i++) {
-		this->Canvas::write(data[i]);
+	checkFonts();
+	rect_t bounds;
+	if (textFill && customFont() && colors.text != colors.textbg) {
+		layoutText(data, len, textRun, bounds, &textBoxes);
+		writeTextBoxes(textRun.data(), textRun.size(), textBoxes.data(), textBoxes.size(),
+				textheight, colors.text, colors.textbg);
+		return;
 	}
-}
-
-void Canvas::write(char c2) {
-	uint8_t c = (uint8_t) c2;
-	if (!gfxFont) { // 'Classic' built-in font
-
-		if (c == '\n') {                        // Newline?
-			cursor_x = 0;                     // Reset x to zero,
-			cursor_y += textheight * 8;          // advance y one line
-		} else if (c == '\r') {
-			cursor_x = 0;                     // Reset x to zero,
-		} else {
-			if (wrap && ((cursor_x + textheight * 6) > _width)) { // Off right?
-				cursor_x = 0;                 // Reset x to zero,
-				cursor_y += textheight * 8;      // advance y one line
+	layoutText(data, len, textRun, bounds);
+	if (textRun.empty())
+		return;
+	// no background on custom fonts unless filled, see writeGlyphs()
+	bool opaque = !customFont() && (colors.text != colors.textbg);
+	writeGlyphs(textRun.data(), textRun.size(), bounds, textheight,
+			colors.text, colors.textbg, opaque);
+}
+
+void Canvas::write(char c) {
+	write(&c, 1);
+}
+
+const TextLayout &Canvas::getTextLayout(const std::string &str, TextAlign align, coord_t width) {
+	checkFonts();
+	coord_t limit = wrap ? (width > 0 ? width : _width) : 0;
+	TextLayoutCache::Key key = { customFont(), textheight, align, width, limit,
+			std::hash<std::string>()(str) };
+	const TextLayout *cached = layoutCache.find(key, str);
+	if (cached != NULL)
+		return *cached;
+
+	TextLayout &l = layoutCache.insert(key, str);
+	l.font = customFont();
+	l.size = textheight;
+	// the glyphs point into the bitmaps of the font, which may be evicted
+	// from preparedFonts while the layout is still cached or copied
+	l.prepared = preparedFont;
+
+	coord_t x = 0, y = 0;
+	uint32_t prev = 0;
+	std::vector<rect_t> none;
+	LineBoxes lines(l.font ? l.boxes : none, fontTop * textheight, fontBottom * textheight, textheight);
+	lines.start(x, y);
+	Utf8Decoder utf8str;
+	Utf8Decoder *dec = l.font ? &utf8str : NULL;
+	for (size_t i = 0; i < str.size(); i++) {
+		uint32_t cps[2];
+		int n = nextChars(dec, str[i], cps);
+		for (int k = 0; k < n; k++) {
+			coord_t px = x, py = y;
+			glyph_t g;
+			bool placed = placeChar(cps[k], x, y, limit, g, prev);
+			if (y != py) {
+				l.breaks.push_back(l.glyphs.size());
+				lines.pen(px);
+				lines.finish();
+				lines.start(0, y);
+			}
+			lines.pen(x);
+			if (placed) {
+				lines.glyph(g);
+				l.glyphs.push_back(g);
 			}
-			drawChar(cursor_x, cursor_y, c, textheight);
-			cursor_x += textheight * 6;          // Advance x one char
 		}
+	}
+	lines.finish();
+	l.lines = l.breaks.size() + 1;
+
+	// right edge of every line, lines are aligned within the box
+	std::vector<coord_t> right(l.lines, 0);
+	coord_t box = 0;
+	for (size_t i = 0, line = 0; i < l.glyphs.size(); i++) {
+		while (line < l.breaks.size() && l.breaks[line] <= i)
+			line++;
+		const glyph_t &g = l.glyphs[i];
+		right[line] = std::max(right[line], (coord_t)(g.x + g.w * textheight));
+		box = std::max(box, right[line]);
+	}
+	if (width > 0)
+		box = width;
+
+	for (size_t i = 0, line = 0; i < l.glyphs.size(); i++) {
+		while (line < l.breaks.size() && l.breaks[line] <= i)
+			line++;
+		glyph_t &g = l.glyphs[i];
+		if (align == ALIGN_CENTER)
+			g.x += (box - right[line]) / 2;
+		else if (align == ALIGN_RIGHT)
+			g.x += box - right[line];
+
+		rect_t b = { g.x, g.y, (coord_t)(g.x + g.w * textheight - 1), (coord_t)(g.y + g.h * textheight - 1) };
+		l.bounds = (i == 0) ? b : unite(l.bounds, b);
+	}
+	for (size_t line = 0; line < l.boxes.size(); line++) {
+		rect_t &b = l.boxes[line];
+		coord_t shift = (align == ALIGN_CENTER) ? (box - right[line]) / 2
+				: (align == ALIGN_RIGHT) ? box - right[line] : 0;
+		b.x0 += shift;
+		b.x1 += shift;
+	}
 
-	} else { // Custom font
+	layoutCache.commit(key);
+	return l;
+}
 
-		if (c == '\n') {
-			cursor_x = 0;
-			cursor_y += (int16_t) textheight * gfxFont->yAdvance;
-		} else if (c == '\r') {
-			cursor_x = 0;
-		} else {
-			uint8_t first = gfxFont->first;
-			if ((c >= first) && (c <= gfxFont->last)) {
-				GFXglyph *glyph = gfxFont->glyph + c - first;
-				uint8_t w = glyph->width, h = glyph->height;
-				if ((w > 0) && (h > 0)) { // Is there an associated bitmap?
-					int16_t xo = glyph->xOffset; // sic
-					if (wrap && ((cursor_x + textheight * (xo + w)) > _width)) {
-						cursor_x = 0;
-						cursor_y += (int16_t) textheight * gfxFont->yAdvance;
-					}
-					drawGlyph(cursor_x, cursor_y, glyph, textheight);
-				}
-				cursor_x += glyph->xAdvance * (int16_t) textheight;
-			}
-		}
+void Canvas::drawText(const TextLayout &layout, coord_t x, coord_t y) {
+	checkFonts();
+	bool fill = textFill && layout.font && (colors.text != colors.textbg);
+	if (layout.empty() && !fill)
+		return;
 
+	textRun.resize(layout.glyphs.size());
+	for (size_t i = 0; i < textRun.size(); i++) {
+		const glyph_t &g = layout.glyphs[i];
+		glyph_t &d = textRun[i];
+		d = g;
+		d.x = realX(x + g.x, y + g.y);
+		d.y = realY(x + g.x, y + g.y);
 	}
+
+	if (fill) {
+		textBoxes.resize(layout.boxes.size());
+		for (size_t i = 0; i < textBoxes.size(); i++) {
+			rect_t b = layout.boxes[i];
+			b.x0 += x;
+			b.x1 += x;
+			b.y0 += y;
+			b.y1 += y;
+			textBoxes[i] = deviceRect(b);
+		}
+		writeTextBoxes(textRun.data(), textRun.size(), textBoxes.data(), textBoxes.size(),
+				layout.size, colors.text, colors.textbg);
+		return;
+	}
+
+	rect_t bounds = layout.bounds;
+	bounds.x0 += x;
+	bounds.x1 += x;
+	bounds.y0 += y;
+	bounds.y1 += y;
+	bounds = deviceRect(bounds);
+
+	// no background on custom fonts unless filled, see writeGlyphs()
+	bool opaque = !layout.font && (colors.text != colors.textbg);
+	writeGlyphs(textRun.data(), textRun.size(), bounds, layout.size,
+			colors.text, colors.textbg, opaque);
 }
 
 void Canvas::setCursor(coord_t x, coord_t y) {
 	cursor_x = x;
 	cursor_y = y;
+	kernPrev = 0;
 }
 
 coord_t Canvas::getCursorX(void) const {
@@ -974,6 +1333,10 @@ void Canvas::setTextWrap(bool w) {
 	wrap = w;
 }
 
+void Canvas::setTextFill(bool fill) {
+	textFill = fill;
+}
+
 uint8_t Canvas::getRotation(void) const {
 	return rotation;
 }
@@ -1029,90 +1392,105 @@ void Canvas::setRotation(uint8_t x) {
 }
 
 void Canvas::setFont(const GFXfont *f) {
-	if (f) {            // Font struct pointer passed in?
-		if (!gfxFont) { // And no current font struct?
+	checkFonts();
+	selectFont(f, NULL, prepareFont(f, NULL));
+}
+
+void Canvas::setFont(const GFXfont2 &f) {
+	checkFonts();
+	selectFont(NULL, &f, prepareFont(NULL, &f));
+}
+
+void Canvas::setFont(const std::shared_ptr<const PreparedFont> &f) {
+	checkFonts();
+	if (f)
+		selectFont(f->getFont(), f->getFont2(), f);
+	else
+		selectFont(NULL, NULL, NULL);
+}
+
+// Repacked font of f or f2, reused from the last PREPARED_FONTS fonts.
+// Anti-aliased glyphs are not repacked, NULL for those and the classic
+// font.
+std::shared_ptr<const PreparedFont> Canvas::prepareFont(const GFXfont *f, const GFXfont2 *f2) {
+	if ((f == NULL && f2 == NULL) || (f2 && f2->bpp > 1))
+		return NULL;
+	for (size_t i = 0; i < preparedFonts.size(); i++) {
+		if (preparedFonts[i]->getFont() == f && preparedFonts[i]->getFont2() == f2) {
+			std::rotate(preparedFonts.begin(), preparedFonts.begin() + i, preparedFonts.begin() + i + 1);
+			return preparedFonts[0];
+		}
+	}
+	if (preparedFonts.size() == PREPARED_FONTS)
+		preparedFonts.pop_back();
+	preparedFonts.insert(preparedFonts.begin(),
+			std::shared_ptr<PreparedFont>(f ? new PreparedFont(f) : new PreparedFont(*f2)));
+	return preparedFonts[0];
+}
+
+void Canvas::selectFont(const GFXfont *f, const GFXfont2 *f2, const std::shared_ptr<const PreparedFont> &p) {
+	if (f || f2) {            // Font struct pointer passed in?
+		if (!customFont()) { // And no current font struct?
 			// Switching from classic to new font behavior.
 			// Move cursor pos down 6 pixels so it's on baseline.
 			cursor_y += 6;
 		}
-	} else if (gfxFont) { // NULL passed.  Current font struct defined?
+	} else if (customFont()) { // NULL passed.  Current font struct defined?
 		// Switching from new to classic font behavior.
 		// Move cursor pos up 6 pixels so it's at top-left of char.
 		cursor_y -= 6;
 	}
 	gfxFont = (GFXfont *) f;
-}
-
-// Broke this out as it's used by both the PROGMEM- and RAM-resident
-// getTextBounds() functions.
-void Canvas::charBounds(char c, coord_t *x, coord_t *y, coord_t *minx, coord_t *miny, coord_t *maxx, coord_t *maxy) {
+	gfxFont2 = f2;
+	preparedFont = p;
+	utf8.reset();
+	kernPrev = 0;
 
+	fontTop = fontBottom = 0;
 	if (gfxFont) {
-
-		if (c == '\n') { // Newline?
-			*x = 0;    // Reset x to zero, advance y by one line
-			*y += textheight * gfxFont->yAdvance;
-		} else if (c != '\r') { // Not a carriage return; is normal char
-			uint8_t first = gfxFont->first, last = gfxFont->last;
-			if ((c >= first) && (c <= last)) { // Char present in this font?
-				GFXglyph *glyph = gfxFont->glyph + (c - first);
-				uint8_t gw = glyph->width, gh = glyph->height, xa = glyph->xAdvance;
-				int8_t xo = glyph->xOffset, yo = glyph->yOffset;
-				if (wrap && ((*x + (((int16_t) xo + gw) * textheight)) > _width)) {
-					*x = 0; // Reset x to zero, advance y by one line
-					*y += textheight * gfxFont->yAdvance;
-				}
-				int16_t ts = (int16_t) textheight, x1 = *x + xo * ts, y1 = *y + yo * ts, x2 = x1 + gw * ts - 1, y2 = y1 + gh * ts - 1;
-				if (x1 < *minx)
-					*minx = x1;
-				if (y1 < *miny)
-					*miny = y1;
-				if (x2 > *maxx)
-					*maxx = x2;
-				if (y2 > *maxy)
-					*maxy = y2;
-				*x += xa * ts;
-			}
+		for (uint32_t c = gfxFont->first; c <= gfxFont->last; c++) {
+			const GFXglyph &g = gfxFont->glyph[c - gfxFont->first];
+			if (g.width == 0 || g.height == 0)
+				continue;
+			fontTop = std::min(fontTop, (coord_t) g.yOffset);
+			fontBottom = std::max(fontBottom, (coord_t)(g.yOffset + g.height));
 		}
-
-	} else { // Default font
-
-		if (c == '\n') {                     // Newline?
-			*x = 0;                        // Reset x to zero,
-			*y += textheight * 8;             // advance y one line
-			// min/max x/y unchaged -- that waits for next 'normal' character
-		} else if (c != '\r') {  // Normal char; ignore carriage returns
-			if (wrap && ((*x + textheight * 6) > _width)) { // Off right?
-				*x = 0;                    // Reset x to zero,
-				*y += textheight * 8;         // advance y one line
-			}
-			int x2 = *x + textheight * 6 - 1, // Lower-right pixel of char
-			y2 = *y + textheight * 8 - 1;
-			if (x2 > *maxx)
-				*maxx = x2;      // Track max x, y
-			if (y2 > *maxy)
-				*maxy = y2;
-			if (*x < *minx)
-				*minx = *x;      // Track min x, y
-			if (*y < *miny)
-				*miny = *y;
-			*x += textheight * 6;             // Advance x one char
+	} else if (gfxFont2) {
+		for (size_t i = 0; i < gfxFont2->glyphCount; i++) {
+			const GFXglyph2 &g = gfxFont2->glyph[i];
+			if (g.width == 0 || g.height == 0)
+				continue;
+			fontTop = std::min(fontTop, (coord_t) g.yOffset);
+			fontBottom = std::max(fontBottom, (coord_t)(g.yOffset + g.height));
 		}
 	}
 }
 
 // Pass string and a cursor position, returns UL corner and W,H.
 void Canvas::getTextBounds(char *str, coord_t x, coord_t y, coord_t *x1, coord_t *y1, coord_t *w, coord_t *h) {
-	uint8_t c; // Current character
-
 	*x1 = x;
 	*y1 = y;
 	*w = *h = 0;
 
 	coord_t minx = _width, miny = _height, maxx = -1, maxy = -1;
 
-	while ((c = *str++))
-		charBounds(c, &x, &y, &minx, &miny, &maxx, &maxy);
+	// walk the string like write() does
+	uint32_t prev = 0;
+	Utf8Decoder utf8str;
+	Utf8Decoder *dec = customFont() ? &utf8str : NULL;
+	for (; *str; str++) {
+		uint32_t cps[2];
+		int n = nextChars(dec, *str, cps);
+		for (int k = 0; k < n; k++) {
+			glyph_t g;
+			if (!placeChar(cps[k], x, y, wrap ? _width : 0, g, prev))
+				continue;
+			minx = std::min(minx, g.x);
+			miny = std::min(miny, g.y);
+			maxx = std::max(maxx, (coord_t)(g.x + g.w * textheight - 1));
+			maxy = std::max(maxy, (coord_t)(g.y + g.h * textheight - 1));
+		}
+	}
 
 	if (maxx >= minx) {
 		*x1 = minx;
@@ -1183,7 +1561,7 @@ void Button::drawButton(bool inverted) {
 		text = _fillcolor;
 	}
 
-	uint8_t r = min(_w, _h) / 4; // Corner radius
+	uint8_t r = std::min(_w, _h) / 4; // Corner radius
 	_gfx->setDrawColor(fill);
 	_gfx->fillRoundRect(_x1, _y1, _w, _h, r);
 	_gfx->setDrawColor(outline);
@@ -1233,170 +1611,7 @@ bool Button::justReleased() {
 // scanline pad).
 // NOT EXTENSIVELY TESTED YET.  MAY CONTAIN WORST BUGS KNOWN TO HUMANKIND.
 
-Canvas1bpp::Canvas1bpp(uint16_t w, uint16_t h) :
-		Canvas(w, h) {
-	size_t linelength = (WIDTH + 7) / 8;
-	uint16_t bytes = linelength * h;
-	buffer = new uint8_t[bytes];
-	initColors();
-}
-
-Canvas1bpp::~Canvas1bpp(void) {
-	delete buffer;
-}
-
-uint8_t* Canvas1bpp::getBuffer(void) {
-	return buffer;
-}
-
-color_t Canvas1bpp::translateColor(color_t color) {
-	color_t x = (color & 0xFF) + ((color >> 8) & 0xFF) + ((color >> 16) & 0xFF);
-	return x < 3 * 128 ? 0 : 1;
-}
-
-void Canvas1bpp::writePixel(coord_t x, coord_t y, color_t color) {
-	if (x < 0 || y < 0 || x >= WIDTH || y >= HEIGHT)
-		return;
-
-	size_t linelength = (WIDTH + 7) / 8;
-	uint8_t *ptr = buffer + (x / 8) + y * linelength;
-	uint8_t off = x & 7;
-	*ptr = (*ptr & (0x7F7F >> off)) | ((color & 1) << (7 - off));
-}
-
-Canvas4bpp::Canvas4bpp(uint16_t w, uint16_t h) :
-		Canvas(w, h) {
-	size_t linelength = (WIDTH + 1) / 2;
-	uint16_t bytes = linelength * h;
-	buffer = new uint8_t[bytes];
-	initColors();
-}
-
-Canvas4bpp::~Canvas4bpp(void) {
-	delete buffer;
-}
-
-uint8_t* Canvas4bpp::getBuffer(void) {
-	return buffer;
-}
-
-color_t Canvas4bpp::translateColor(color_t color) {
-	color_t x = (color & 0xFF) + ((color >> 8) & 0xFF) + ((color >> 16) & 0xFF);
-	return x / 3;
-}
-
-void Canvas4bpp::writePixel(coord_t x, coord_t y, color_t color) {
-	if (x < 0 || y < 0 || x >= WIDTH || y >= HEIGHT)
-		return;
-
-	size_t linelength = (WIDTH + 1) / 2;
-	uint8_t *ptr = buffer + (x / 2) + y * linelength;
-	uint8_t shift = (x & 1) << 2;
-	*ptr = (*ptr & (0xF0F >> shift)) | ((color & 0xF) << (4 - shift));
-}
-
-void Canvas4bpp::writeHLine(coord_t x0, coord_t y0, coord_t x1, color_t color) {
-	if (y0 < 0 || y0 >= HEIGHT)
-		return;
-	if (x0 < 0)
-		x0 = 0;
-	if (x1 >= WIDTH)
-		x1 = WIDTH-1;
-
-	uint8_t shift0 = (x0 & 1) << 2;
-	uint8_t shift1 = (x1 & 1) << 2;
-	uint8_t amask0 = (0xF00 >> shift0);
-	uint8_t amask1 = (0x00F >> shift1);
-
-	uint8_t omask = (color & 0xF) | ((color & 0xF) << 4);
-
-	size_t linelength = (WIDTH + 1) / 2;
-	uint8_t *ptr0 = buffer + (x0 / 2) + y0 * linelength;
-	uint8_t *ptr1 = buffer + (x1 / 2) + y0 * linelength;
-
-	if (ptr0 == ptr1) {
-		uint8_t amask = amask0 | amask1;
-		*ptr0 = (*ptr0 & amask) | (omask & ~amask);
-	} else if (ptr0 < ptr1) {
-		*ptr0 = (*ptr0 & amask0) | (omask & ~amask0);
-		for (ptr0++; ptr0 < ptr1; ptr0++) {
-			*ptr0 = omask;
-		}
-		*ptr1 = (*ptr1 & amask1) | (omask & ~amask1);
-	}
-}
-
-void Canvas4bpp::writeVLine(coord_t x0, coord_t y0, coord_t y1, color_t color) {
-	if (x0 < 0 || x0 >= WIDTH)
-		return;
-	if (y0 < 0)
-		x0 = 0;
-	if (y1 >= HEIGHT)
-		y1 = HEIGHT-1;
-
-	uint8_t shift = (x0 & 1) << 2;
-	uint8_t amask = (0xF0F >> shift);
-	uint8_t omask = (color & 0xF) << (4 - shift);
-
-	size_t linelength = (WIDTH + 1) / 2;
-	uint8_t *ptr1 = buffer + (x0 / 2) + y1 * linelength;
-	for (uint8_t *ptr0 = buffer + (x0 / 2) + y0 * linelength; ptr0 <= ptr1; ptr0 += linelength) {
-		*ptr0 = (*ptr0 & amask) | omask;
-	}
-}
-
-
-Canvas8bpp::Canvas8bpp(uint16_t w, uint16_t h) :
-		Canvas(w, h) {
-	uint32_t bytes = w * h;
-	buffer = new uint8_t[bytes];
-	initColors();
-}
-
-Canvas8bpp::~Canvas8bpp(void) {
-	delete buffer;
-}
-
-uint8_t* Canvas8bpp::getBuffer(void) {
-	return buffer;
-}
-
-color_t Canvas8bpp::translateColor(color_t color) {
-	color_t x = (color & 0xFF) + ((color >> 8) & 0xFF) + ((color >> 16) & 0xFF);
-	return x / 3;
-}
-
-void Canvas8bpp::writePixel(coord_t x, coord_t y, color_t color) {
-	if (x < 0 || y < 0 || x >= WIDTH || y >= HEIGHT)
-		return;
-
-	buffer[x + y * WIDTH] = color;
-}
-
-Canvas16bpp::Canvas16bpp(uint16_t w, uint16_t h) :
-		Canvas(w, h) {
-	uint32_t bytes = w * h;
-	buffer = new uint16_t[bytes];
-	initColors();
-}
-
-Canvas16bpp::~Canvas16bpp(void) {
-	delete buffer;
-}
-
-uint16_t* Canvas16bpp::getBuffer(void) {
-	return buffer;
-}
-
-color_t Canvas16bpp::translateColor(color_t color) {
-	return ((color & 0xF8) >> 3)
-			| ((color & 0xFC00) >> 5)
-			| ((color & 0xF80000) >> 8);
-}
-
-void Canvas16bpp::writePixel(coord_t x, coord_t y, color_t color) {
-	if (x < 0 || y < 0 || x >= WIDTH || y >= HEIGHT)
-		return;
-
-	buffer[x + y * WIDTH] = color;
-}
+template class GFX::CanvasT<Format1bpp>;
+template class GFX::CanvasT<Format4bpp>;
+template class GFX::CanvasT<Format8bpp>;
+template class GFX::CanvasT<Format16bpp>;
@@ -1,16 +1,22 @@
 #ifndef _ADAFRUIT_GFX_H
 #define _ADAFRUIT_GFX_H
 
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 #include "Print.h"
+#include "Blend.h"
+#include "GlyphCache.h"
+#include "PixelFormat.h"
+#include "PreparedFont.h"
+#include "TextLayout.h"
+#include "Utf8.h"
 #include "gfxfont.h"
 
 namespace GFX {
 
-typedef int32_t coord_t;
-typedef uint32_t color_t;
-
 static const color_t COLOR_BLACK = 0x000000;
 static const color_t COLOR_GRAY1 = 0x111111;
 static const color_t COLOR_GRAY2 = 0x222222;
@@ -31,11 +37,42 @@ static const color_t COLOR_RED   = 0xFF0000;
 static const color_t COLOR_GREEN = 0x00FF00;
 static const color_t COLOR_BLUE  = 0x0000FF;
 
+// Small set of rectangles in device coordinates covering the pixels
+// modified since it was last cleared.  Rectangles are merged when that
+// does not waste pixels, and forcibly once MAX_RECTS is reached.
+class DamageList {
+public:
+	static const size_t MAX_RECTS = 8;
+
+	DamageList() : last(0) {
+		//nothing
+	}
+
+	void add(const rect_t &r);
+	void add(const DamageList &other);
+	void clear() {
+		rects.clear();
+		last = 0;
+	}
+	bool empty() const {
+		return rects.empty();
+	}
+	const std::vector<rect_t> &getRects() const {
+		return rects;
+	}
+private:
+	std::vector<rect_t> rects;
+	size_t last; // most recently grown rect, checked first
+};
+
 class Canvas: public Print {
 private:
 	GFXfont *gfxFont;
+	const GFXfont2 *gfxFont2;
+	// repacked bitmaps of the font or NULL, shared with the layouts made
+	// with it
+	std::shared_ptr<const PreparedFont> preparedFont;
 	uint8_t rotation;
-	int8_t mrot[4];
 	coord_t vtrans[2];
 	coord_t _width;
 	coord_t _height;
@@ -53,9 +90,65 @@ private:
 	coord_t cursor_y;
 	coord_t textheight;
 	bool wrap;
+	bool textFill;
+	// extent of the glyphs of the custom font around the baseline, unscaled
+	coord_t fontTop, fontBottom;
+
+	static const size_t RUN_CACHE_SIZE = 16 * 1024;
+	static const size_t LAYOUT_CACHE_SIZE = 16 * 1024;
+	static const size_t PREPARED_FONTS = 8;
+
+	std::vector<rect_t> clipStack;
+	DamageList damage;
+	RunCache runCache;
+	Utf8Decoder utf8; // state of write() between calls
+	uint32_t kernPrev; // glyph number + 1 before the cursor, 0 for none
+	std::vector<glyph_t> textRun; // reused by write() and drawText()
+	std::vector<rect_t> textBoxes;
+	std::vector<uint8_t> textMask;
+	std::vector<span_t> textSpans[16]; // per coverage level
+	TextLayoutCache layoutCache;
+	// fonts repacked by setFont(), most recently selected first.  Shared
+	// with the layouts that point into their bitmaps.
+	std::vector<std::shared_ptr<PreparedFont> > preparedFonts;
+	// fontEpoch when the caches above were last checked, see forgetFonts()
+	uint32_t fontGeneration;
+	static std::atomic<uint32_t> fontEpoch;
+
+	// generic sink for the algorithms in Primitives.h, clips against the
+	// clip rectangle before dispatching through the core draw API
+	struct Sink {
+		Canvas &c;
+		void pixel(coord_t x, coord_t y, color_t color) {
+			const rect_t &r = c.clip;
+			if (x >= r.x0 && y >= r.y0 && x <= r.x1 && y <= r.y1)
+				c.writePixel(x, y, color);
+		}
+		void hline(coord_t x0, coord_t y, coord_t x1, color_t color) {
+			c.writeHLine(x0, y, x1, color);
+		}
+		void vline(coord_t x, coord_t y0, coord_t y1, color_t color) {
+			c.writeVLine(x, y0, y1, color);
+		}
+		void rect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color) {
+			c.writeFillRect(x0, y0, x1, y1, color);
+		}
+		void spans(const span_t *spans, size_t n, color_t color) {
+			c.writeSpans(spans, n, color);
+		}
+	};
 
 	void drawChar(coord_t x, coord_t y, unsigned char c, coord_t size);
-	void drawGlyph(coord_t x, coord_t y, GFXglyph *glyph, coord_t size);
+	void selectFont(const GFXfont *f, const GFXfont2 *f2, const std::shared_ptr<const PreparedFont> &p);
+	std::shared_ptr<const PreparedFont> prepareFont(const GFXfont *f, const GFXfont2 *f2);
+
+	// current custom font of either version, NULL for the classic font
+	const void *customFont() const {
+		return gfxFont ? (const void *) gfxFont : (const void *) gfxFont2;
+	}
+	coord_t fontYAdvance() const {
+		return gfxFont ? gfxFont->yAdvance : gfxFont2->yAdvance;
+	}
 
 	coord_t dirX(coord_t x, coord_t y) {
 		return mrot[0] * x + mrot[1] * y;
@@ -72,26 +165,122 @@ private:
 
 protected:
 	const coord_t WIDTH, HEIGHT; // This is the 'raw' display w/h - never changes
+	int8_t mrot[4]; // rotation matrix, maps logical to device directions
+	rect_t clip;    // clip rectangle in device coordinates
+
+	enum ClipResult {
+		CLIP_OUTSIDE, CLIP_PARTIAL, CLIP_INSIDE
+	};
+
+	// Trivial reject/accept of a device bounding box against the clip rect
+	ClipResult clipTest(coord_t x0, coord_t y0, coord_t x1, coord_t y1) const {
+		if (x1 < clip.x0 || y1 < clip.y0 || x0 > clip.x1 || y0 > clip.y1)
+			return CLIP_OUTSIDE;
+		if (x0 >= clip.x0 && y0 >= clip.y0 && x1 <= clip.x1 && y1 <= clip.y1)
+			return CLIP_INSIDE;
+		return CLIP_PARTIAL;
+	}
+	ClipResult clipTest(const rect_t &r) const {
+		return clipTest(r.x0, r.y0, r.x1, r.y1);
+	}
+	// Like clipTest(), additionally records the visible part as damage
+	ClipResult clipDamage(coord_t x0, coord_t y0, coord_t x1, coord_t y1) {
+		ClipResult cr = clipTest(x0, y0, x1, y1);
+		if (cr != CLIP_OUTSIDE)
+			damageRect(x0, y0, x1, y1);
+		return cr;
+	}
+	ClipResult clipDamage(const rect_t &r) {
+		return clipDamage(r.x0, r.y0, r.x1, r.y1);
+	}
+	// Device bounding box of the arguments of writeBitmap()
+	rect_t bitmapBounds(coord_t x, coord_t y, coord_t w, coord_t h, coord_t size) const;
+	// Device rectangle covering a logical one, empty stays empty
+	rect_t deviceRect(const rect_t &r);
+	// Record the part of the rectangle inside the clip as modified
+	void damageRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1);
+	// Cached run list of the glyph passed to writeGlyph()
+	const std::vector<run_t> &glyphRuns(const void *font, uint32_t code,
+			const uint8_t *bitmap, size_t stride, unsigned bpp, coord_t w, coord_t h) {
+		return runCache.get(font, code, bitmap, stride, bpp, w, h);
+	}
+	// Colors of the coverage levels 0 to max of opaque anti-aliased text
+	void textRamp(color_t *ramp, unsigned max, color_t color, color_t bg) {
+		for (unsigned a = 0; a <= max; a++)
+			ramp[a] = mixColor(bg, color, a, max);
+	}
 
 	virtual void write(char);
 	virtual void write(const char *, size_t);
-	void charBounds(char c, coord_t *x, coord_t *y, coord_t *minx, coord_t *miny, coord_t *maxx, coord_t *maxy);
+	// Place the glyphs of a string at the cursor like write() would and
+	// advance the cursor.  bounds is the device bounding box of all
+	// glyphs, only valid if glyphs is not empty.  If boxes is not NULL it
+	// receives the device line boxes of custom font text, see
+	// TextLayout::getLineBoxes().
+	void layoutText(const char *str, size_t len, std::vector<glyph_t> &glyphs, rect_t &bounds,
+			std::vector<rect_t> *boxes = NULL);
+	// Advance the pen (x,y) over character c of the current font like
+	// write() does, wrapping lines wider than limit if limit > 0.  Returns
+	// true and the glyph at its logical position if c has a bitmap.  c is
+	// a code point for custom fonts and a byte for the classic font.  prev
+	// is the glyph number + 1 of the previous character for kerning, 0 at
+	// the start of a string.
+	bool placeChar(uint32_t c, coord_t &x, coord_t &y, coord_t limit, glyph_t &g, uint32_t &prev) const;
 
 	void initColors();
 
 	// TRANSACTION API / CORE DRAW API
 	// Colors are translated, coordinates are unroated.
+	// writePixel() is only called for pixels inside the clip rectangle,
+	// everything else must not touch pixels outside of it.  All of them
+	// must record the pixels they modify with damageRect() or clipDamage().
 	// This MUST be defined by the subclass:
 	virtual color_t translateColor(color_t color) = 0;
 	virtual void writePixel(coord_t x, coord_t y, color_t color) = 0;
 	// These MAY be overridden by the subclass to provide device-specific
 	// optimized code.  Otherwise 'generic' versions are used.
+	// Color a/max of the way from dst to src, the generic version has no
+	// intermediate colors and picks the nearer one.
+	virtual color_t mixColor(color_t dst, color_t src, unsigned a, unsigned max);
 	virtual void writeHLine(coord_t x0, coord_t y0, coord_t x1, color_t color);
 	virtual void writeVLine(coord_t x0, coord_t y0, coord_t y1, color_t color);
 	virtual void writeLine(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color);
-
-	void drawCircleHelper(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY);
-	void fillCircleHelper(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY);
+	// Batch of horizontal lines in one color, spans need not be sorted
+	virtual void writeSpans(const span_t *spans, size_t n, color_t color);
+	// Coordinates are sorted: x0 <= x1, y0 <= y1
+	virtual void writeFillRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color);
+	// Circle outline resp. filled circle without its center line.  The right
+	// and bottom halves are shifted by deltaX/deltaY to draw round rects.
+	virtual void writeCircle(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY, color_t color);
+	virtual void writeFillCircle(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY, color_t color);
+	virtual void writeFillTriangle(coord_t x0, coord_t y0, coord_t x1, coord_t y1, coord_t x2, coord_t y2, color_t color);
+	// 1-bit bitmap at device position (x,y), rotated by mrot, scaled by size.
+	// Rows start 'stride' bits apart, see prim::bitmap().
+	virtual void writeBitmap(coord_t x, coord_t y, const uint8_t *bitmap, size_t stride,
+			coord_t w, coord_t h, coord_t size, color_t color, color_t bg, bool opaque);
+	// Like writeBitmap() for glyph 'code' of 'font' (NULL for the classic
+	// font); the same glyph always comes with the same bitmap, so it may
+	// be drawn from a cache.  Bitmaps of anti-aliased fonts have bpp > 1,
+	// their coverage is blended with the canvas unless opaque.
+	virtual void writeGlyph(coord_t x, coord_t y, const void *font, uint32_t code,
+			const uint8_t *bitmap, size_t stride, unsigned bpp, coord_t w, coord_t h, coord_t size,
+			color_t color, color_t bg, bool opaque);
+	// All glyphs of a string, bounds is the device bounding box of all of
+	// them, so it can be clipped as a whole.
+	virtual void writeGlyphs(const glyph_t *glyphs, size_t n, const rect_t &bounds,
+			coord_t size, color_t color, color_t bg, bool opaque);
+	// Glyphs composited onto the device line boxes filled with bg, every
+	// pixel of a box is written once.  Empty boxes (x1 < x0) are skipped.
+	void writeTextBoxes(const glyph_t *glyphs, size_t n, const rect_t *boxes, size_t nboxes,
+			coord_t size, color_t color, color_t bg);
+	// Drop what writeGlyph() cached, see forgetFonts()
+	virtual void clearGlyphCache();
+	// Drop the font caches if forgetFonts() was called since the last check
+	void checkFonts() {
+		if (fontGeneration != fontEpoch.load(std::memory_order_relaxed))
+			clearFontCaches();
+	}
+	void clearFontCaches();
 
 public:
 	class ColorSafe {
@@ -118,7 +307,20 @@ public:
 	void setTextColor(color_t c, color_t bg);
 	void setTextSize(coord_t s);
 	void setTextWrap(bool w);
+	// Fill the lines of custom font text with the text background color,
+	// from the top to the bottom of the font.  Glyphs and background are
+	// composited first, so text can be redrawn in place without flicker.
+	void setTextFill(bool fill);
+	// Custom fonts are identified by the address of their GFXfont or
+	// GFXfont2 in the caches of canvases, see forgetFonts().
 	void setFont(const GFXfont *f = NULL);
+	// Version 2 font, see gfxfont.h.  Text in custom fonts of either
+	// version is decoded as UTF-8, the classic font takes bytes as is.
+	void setFont(const GFXfont2 &f);
+	// Font repacked once for any number of canvases, see PreparedFont.
+	// setFont() repacks the last few fonts of each canvas by itself.  The
+	// canvas and the layouts made with f keep it alive.
+	void setFont(const std::shared_ptr<const PreparedFont> &f);
 
 	void setTextColor(color_t c) {
 		setTextColor(c, c);
@@ -132,6 +334,35 @@ public:
 	coord_t getTextSize() const;
 	void getTextBounds(char *string, coord_t x, coord_t y, coord_t *x0, coord_t *y0, coord_t *w, coord_t *h);
 
+	// Layout of str in the current font and text size, taken from a cache
+	// of recently used layouts.  Lines are wrapped at the canvas width if
+	// text wrap is on, resp. at width if it is > 0, and aligned within
+	// width or the widest line.  The reference is valid until the next
+	// call, copy the layout to keep it.
+	const TextLayout &getTextLayout(const std::string &str, TextAlign align = ALIGN_LEFT, coord_t width = 0);
+	// Draw a layout with its origin at (x,y) in the current text colors,
+	// the cursor is not moved
+	void drawText(const TextLayout &layout, coord_t x, coord_t y);
+
+	// Restrict drawing to the rectangle (x0,y0)-(x1,y1), intersected with
+	// the current clip.  Coordinates are rotated like those of fillRect(),
+	// the clip stays attached to the same pixels if the rotation changes.
+	void pushClip(coord_t x0, coord_t y0, coord_t x1, coord_t y1);
+	// Restore the clip rectangle active before the matching pushClip()
+	void popClip();
+
+	// Rectangles (device coordinates) modified since the last clearDamage()
+	const DamageList &getDamage() const;
+	void clearDamage();
+	// Back to the settings of a new canvas: rotation 0, no clip, classic
+	// font, default colors and cursor, no damage.  Pixels and caches stay.
+	void reset();
+	// Call after freeing fonts, so their addresses may be reused by other
+	// fonts.  All canvases drop their cached glyphs, runs, layouts and
+	// repacked fonts before they draw or lay out text next.  FontFile
+	// calls it when it is destroyed.
+	static void forgetFonts();
+
 	// These exist only with Adafruit_GFX (no subclass overrides)
 	void clearScreen();
 	void drawPixel(coord_t x, coord_t y);
@@ -187,55 +418,130 @@ private:
 	bool currstate, laststate;
 };
 
-class Canvas1bpp: public Canvas {
-public:
-	Canvas1bpp(uint16_t w, uint16_t h);
-	~Canvas1bpp(void);
-	uint8_t *getBuffer(void);
-protected:
-	virtual color_t translateColor(color_t color);
-	virtual void writePixel(coord_t x, coord_t y, color_t color);
-private:
-	uint8_t *buffer;
+template<class F> class CanvasArena;
+
+// Alignment of the rows of a canvas buffer in bytes.  Rows are padded to
+// a multiple of it and start on such a boundary, so row kernels can use
+// aligned vector loads and stores.
+enum RowAlign {
+	ROW_PACKED = 1, ROW_ALIGN16 = 16, ROW_ALIGN32 = 32, ROW_ALIGN64 = 64
 };
 
-class Canvas4bpp: public Canvas {
+// Offscreen canvas for the pixel format F (see PixelFormat.h).  Every
+// primitive of the core draw API is instantiated with the pixel store of F
+// inlined, so drawing costs one virtual call per primitive instead of one
+// per pixel or scanline.  The member definitions are in CanvasT.h; the
+// formats below are instantiated in Canvas.cpp.
+template<class F>
+class CanvasT: public Canvas {
 public:
-	Canvas4bpp(uint16_t w, uint16_t h);
-	~Canvas4bpp(void);
-	uint8_t *getBuffer(void);
+	typedef typename F::unit_t unit_t;
+
+	CanvasT(coord_t w, coord_t h, RowAlign align = ROW_PACKED);
+	// Draw into an externally owned buffer (shared memory, DMA, a pool)
+	// of h rows starting stride bytes apart, lineLength(w) units of them
+	// used.  stride 0 packs the rows.  throws std::runtime_error if stride
+	// is too small or not a multiple of the unit size.
+	CanvasT(coord_t w, coord_t h, unit_t *buffer, size_t stride = 0);
+	// View of the w x h pixels at device position (x,y) of parent, sharing
+	// its pixels and stride.  x must start a storage unit (a multiple of 8
+	// for 1bpp, 2 for 4bpp).  Valid while the buffer of parent is.  throws
+	// std::runtime_error if the rectangle is outside parent or x is not
+	// aligned.
+	CanvasT(CanvasT &parent, coord_t x, coord_t y, coord_t w, coord_t h);
+	~CanvasT(void);
+	unit_t *getBuffer(void);
+	// Bytes from one row of the buffer to the next
+	size_t getStride(void) const;
+	// Stride of rows w pixels wide padded to align
+	static size_t stride(coord_t w, RowAlign align = ROW_PACKED);
+
+	// Memory for pre-rendered glyphs, 0 disables the glyph cache
+	void setGlyphCacheSize(size_t bytes);
 protected:
+	// rebind to another externally owned buffer of the same size and stride
+	void setBuffer(unit_t *buffer);
+
 	virtual color_t translateColor(color_t color);
 	virtual void writePixel(coord_t x, coord_t y, color_t color);
 	virtual void writeHLine(coord_t x0, coord_t y0, coord_t x1, color_t color);
 	virtual void writeVLine(coord_t x0, coord_t y0, coord_t y1, color_t color);
+	virtual void writeLine(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color);
+	virtual void writeSpans(const span_t *spans, size_t n, color_t color);
+	virtual void writeFillRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color);
+	virtual void writeCircle(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY, color_t color);
+	virtual void writeFillCircle(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY, color_t color);
+	virtual void writeFillTriangle(coord_t x0, coord_t y0, coord_t x1, coord_t y1, coord_t x2, coord_t y2, color_t color);
+	virtual void writeBitmap(coord_t x, coord_t y, const uint8_t *bitmap, size_t stride,
+			coord_t w, coord_t h, coord_t size, color_t color, color_t bg, bool opaque);
+	virtual color_t mixColor(color_t dst, color_t src, unsigned a, unsigned max);
+	virtual void writeGlyph(coord_t x, coord_t y, const void *font, uint32_t code,
+			const uint8_t *bitmap, size_t stride, unsigned bpp, coord_t w, coord_t h, coord_t size,
+			color_t color, color_t bg, bool opaque);
+	virtual void writeGlyphs(const glyph_t *glyphs, size_t n, const rect_t &bounds,
+			coord_t size, color_t color, color_t bg, bool opaque);
+	virtual void clearGlyphCache();
 private:
-	uint8_t *buffer;
+	static const size_t GLYPH_CACHE_SIZE = 32 * 1024;
+
+	template<class G> friend class CanvasArena;
+
+	unit_t *buffer;
+	size_t linelength; // units from one row to the next
+	unit_t *storage;   // allocation buffer points into, NULL if not owned
+	GlyphCache<F> glyphCache;
+	// coverage levels of transparent anti-aliased glyphs, one byte per
+	// pixel, blended with blendTable of the last text color
+	GlyphCache<Format8bpp> levelCache;
+	BlendTable<F> blendTable;
+
+	// inlined pixel store, clips against the clip rectangle if CLIP is set
+	template<bool CLIP> void putPixel(coord_t x, coord_t y, color_t color);
+	template<bool CLIP> void putHLine(coord_t x0, coord_t y, coord_t x1, color_t color);
+	template<bool CLIP> void putVLine(coord_t x, coord_t y0, coord_t y1, color_t color);
+	template<bool CLIP> void putRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color);
+	template<bool CLIP> void putSpans(const span_t *spans, size_t n, color_t color);
+	// blend the color of blendTable into a rectangle at coverage level
+	template<bool CLIP> void putBlend(coord_t x0, coord_t y0, coord_t x1, coord_t y1, unsigned level);
+	// glyph with device bounds b, cr is the clip result of b
+	void putGlyph(const glyph_t &g, const rect_t &b, ClipResult cr,
+			coord_t size, color_t color, color_t bg, bool opaque);
+
+	// Sink for the algorithms in Primitives.h.  Sink<false> is used for
+	// primitives entirely inside the clip rectangle and has no checks.
+	template<bool CLIP>
+	struct Sink {
+		CanvasT &c;
+		void pixel(coord_t x, coord_t y, color_t color) {
+			c.template putPixel<CLIP>(x, y, color);
+		}
+		void hline(coord_t x0, coord_t y, coord_t x1, color_t color) {
+			c.template putHLine<CLIP>(x0, y, x1, color);
+		}
+		void vline(coord_t x, coord_t y0, coord_t y1, color_t color) {
+			c.template putVLine<CLIP>(x, y0, y1, color);
+		}
+		void rect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color) {
+			c.template putRect<CLIP>(x0, y0, x1, y1, color);
+		}
+		void spans(const span_t *spans, size_t n, color_t color) {
+			c.template putSpans<CLIP>(spans, n, color);
+		}
+		void blend(coord_t x0, coord_t y0, coord_t x1, coord_t y1, unsigned level) {
+			c.template putBlend<CLIP>(x0, y0, x1, y1, level);
+		}
+	};
 };
 
-class Canvas8bpp: public Canvas {
-public:
-	Canvas8bpp(uint16_t w, uint16_t h);
-	~Canvas8bpp(void);
-	uint8_t *getBuffer(void);
-protected:
-	virtual color_t translateColor(color_t color);
-	virtual void writePixel(coord_t x, coord_t y, color_t color);
-private:
-	uint8_t *buffer;
-};
+extern template class CanvasT<Format1bpp>;
+extern template class CanvasT<Format4bpp>;
+extern template class CanvasT<Format8bpp>;
+extern template class CanvasT<Format16bpp>;
 
-class Canvas16bpp: public Canvas {
-public:
-	Canvas16bpp(uint16_t w, uint16_t h);
-	~Canvas16bpp(void);
-	uint16_t *getBuffer(void);
-protected:
-	virtual color_t translateColor(color_t color);
-	virtual void writePixel(coord_t x, coord_t y, color_t color);
-private:
-	uint16_t *buffer;
-};
+typedef CanvasT<Format1bpp> Canvas1bpp;
+typedef CanvasT<Format4bpp> Canvas4bpp;
+typedef CanvasT<Format8bpp> Canvas8bpp;
+typedef CanvasT<Format16bpp> Canvas16bpp;
 
 
 }
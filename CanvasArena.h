@@ -0,0 +1,96 @@
+#ifndef _CANVASARENA_H_
+#define _CANVASARENA_H_
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Canvas.h"
+
+namespace GFX {
+
+// Temporary canvases of the pixel format F, e.g. for rendering widgets
+// offscreen every frame.  The pixels of all canvases come from one block
+// allocated up front, reset() takes back all canvases at once.  Canvas
+// objects are kept and handed out again for the same size, so once the
+// sizes in use have been seen, acquire() does not touch the heap.
+template<class F>
+class CanvasArena {
+public:
+	typedef typename F::unit_t unit_t;
+
+	// Arena for the pixels of canvases of up to bytes in total, with rows
+	// padded to align
+	explicit CanvasArena(size_t bytes, RowAlign align = ROW_PACKED) :
+			memory(new unit_t[bytes / sizeof(unit_t)]), capacity(bytes / sizeof(unit_t)), used(0), taken(0),
+			align(align) {
+		//nothing
+	}
+
+	// Canvas of w x h pixels in the state of a new one (see
+	// Canvas::reset()), its pixels are undefined.  Valid until the next
+	// reset(), NULL if the arena has no room left for its pixels.
+	CanvasT<F> *acquire(coord_t w, coord_t h) {
+		// buffers start on 64-byte boundaries for the row fills
+		uintptr_t base = (uintptr_t) memory.get();
+		size_t start = (((base + used * sizeof(unit_t) + 63) & ~(uintptr_t) 63) - base) / sizeof(unit_t);
+		size_t stride = CanvasT<F>::stride(w, align);
+		size_t units = stride / sizeof(unit_t) * h;
+		if (start > capacity || units > capacity - start)
+			return NULL;
+		unit_t *buffer = memory.get() + start;
+
+		CanvasT<F> *c = NULL;
+		for (size_t i = taken; i < canvases.size(); i++) {
+			if (canvases[i]->WIDTH == w && canvases[i]->HEIGHT == h) {
+				std::swap(canvases[i], canvases[taken]);
+				c = canvases[taken].get();
+				c->setBuffer(buffer);
+				c->reset();
+				break;
+			}
+		}
+		if (c == NULL) {
+			canvases.emplace_back(new CanvasT<F>(w, h, buffer, stride));
+			std::swap(canvases.back(), canvases[taken]);
+			c = canvases[taken].get();
+		}
+		taken++;
+		used = start + units;
+		return c;
+	}
+
+	// Take back all canvases handed out by acquire()
+	void reset() {
+		taken = 0;
+		used = 0;
+	}
+
+	// Destroy the canvases kept for reuse, implies reset()
+	void clear() {
+		canvases.clear();
+		reset();
+	}
+
+	// Bytes of pixels handed out since the last reset() and in total
+	size_t getUsed() const {
+		return used * sizeof(unit_t);
+	}
+	size_t getCapacity() const {
+		return capacity * sizeof(unit_t);
+	}
+
+private:
+	std::unique_ptr<unit_t[]> memory;
+	size_t capacity; // units
+	size_t used;     // units handed out since reset()
+	// all canvases, the first 'taken' of them handed out since reset()
+	std::vector<std::unique_ptr<CanvasT<F> > > canvases;
+	size_t taken;
+	RowAlign align;
+};
+
+}
+
+#endif // _CANVASARENA_H_
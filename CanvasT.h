@@ -0,0 +1,466 @@
+#ifndef _CANVAS_T_H_
+#define _CANVAS_T_H_
+
+// Member definitions of CanvasT.  Only needed to instantiate CanvasT for
+// additional pixel formats; the formats in PixelFormat.h are instantiated
+// in Canvas.cpp.
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "Canvas.h"
+#include "Primitives.h"
+
+namespace GFX {
+
+template<class F>
+CanvasT<F>::CanvasT(coord_t w, coord_t h, RowAlign align) :
+		Canvas(w, h), glyphCache(GLYPH_CACHE_SIZE), levelCache(GLYPH_CACHE_SIZE) {
+	linelength = stride(WIDTH, align) / sizeof(unit_t);
+	size_t units = linelength * (size_t) h;
+	// room to move the start to the next align boundary
+	storage = new unit_t[units + (align - 1) / sizeof(unit_t)];
+	uintptr_t p = (uintptr_t) storage;
+	buffer = (unit_t *) ((p + align - 1) & ~(uintptr_t) (align - 1));
+	initColors();
+}
+
+template<class F>
+CanvasT<F>::CanvasT(coord_t w, coord_t h, unit_t *buffer, size_t stride) :
+		Canvas(w, h), buffer(buffer), glyphCache(GLYPH_CACHE_SIZE), levelCache(GLYPH_CACHE_SIZE) {
+	linelength = F::lineLength(WIDTH);
+	if (stride != 0) {
+		if (stride % sizeof(unit_t) || stride / sizeof(unit_t) < linelength)
+			throw std::runtime_error("invalid canvas stride");
+		linelength = stride / sizeof(unit_t);
+	}
+	storage = NULL;
+	initColors();
+}
+
+template<class F>
+CanvasT<F>::CanvasT(CanvasT &parent, coord_t x, coord_t y, coord_t w, coord_t h) :
+		Canvas(w, h), glyphCache(GLYPH_CACHE_SIZE), levelCache(GLYPH_CACHE_SIZE) {
+	const coord_t ppu = sizeof(unit_t) * 8 / F::BITS;
+	if (x < 0 || y < 0 || w <= 0 || h <= 0 || x % ppu
+			|| w > parent.WIDTH - x || h > parent.HEIGHT - y)
+		throw std::runtime_error("invalid canvas view");
+	linelength = parent.linelength;
+	buffer = parent.buffer + y * linelength + x / ppu;
+	storage = NULL;
+	initColors();
+}
+
+template<class F>
+CanvasT<F>::~CanvasT(void) {
+	delete[] storage;
+}
+
+template<class F>
+void CanvasT<F>::setBuffer(unit_t *buffer) {
+	delete[] storage;
+	storage = NULL;
+	this->buffer = buffer;
+}
+
+template<class F>
+typename CanvasT<F>::unit_t* CanvasT<F>::getBuffer(void) {
+	return buffer;
+}
+
+template<class F>
+size_t CanvasT<F>::getStride(void) const {
+	return linelength * sizeof(unit_t);
+}
+
+template<class F>
+size_t CanvasT<F>::stride(coord_t w, RowAlign align) {
+	size_t bytes = F::lineLength(w) * sizeof(unit_t);
+	return (bytes + align - 1) & ~(size_t) (align - 1);
+}
+
+template<class F>
+void CanvasT<F>::setGlyphCacheSize(size_t bytes) {
+	glyphCache.setLimit(bytes);
+	levelCache.setLimit(bytes);
+}
+
+template<class F>
+void CanvasT<F>::clearGlyphCache() {
+	Canvas::clearGlyphCache();
+	glyphCache.clear();
+	levelCache.clear();
+}
+
+template<class F>
+color_t CanvasT<F>::translateColor(color_t color) {
+	return F::translate(color);
+}
+
+template<class F>
+template<bool CLIP>
+inline void CanvasT<F>::putPixel(coord_t x, coord_t y, color_t color) {
+	if (CLIP && (x < clip.x0 || y < clip.y0 || x > clip.x1 || y > clip.y1))
+		return;
+
+	F::put(buffer + y * linelength, x, color);
+}
+
+template<class F>
+template<bool CLIP>
+inline void CanvasT<F>::putHLine(coord_t x0, coord_t y, coord_t x1, color_t color) {
+	if (CLIP) {
+		if (y < clip.y0 || y > clip.y1)
+			return;
+		if (x0 < clip.x0)
+			x0 = clip.x0;
+		if (x1 > clip.x1)
+			x1 = clip.x1;
+	}
+	if (x0 > x1)
+		return;
+
+	F::fill(buffer + y * linelength, x0, x1, color);
+}
+
+template<class F>
+template<bool CLIP>
+inline void CanvasT<F>::putVLine(coord_t x, coord_t y0, coord_t y1, color_t color) {
+	if (CLIP) {
+		if (x < clip.x0 || x > clip.x1)
+			return;
+		if (y0 < clip.y0)
+			y0 = clip.y0;
+		if (y1 > clip.y1)
+			y1 = clip.y1;
+	}
+	if (y0 > y1)
+		return;
+
+	F::column(buffer + y0 * linelength, linelength, x, y1 - y0 + 1, color);
+}
+
+template<class F>
+template<bool CLIP>
+inline void CanvasT<F>::putRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color) {
+	if (CLIP) {
+		if (x0 < clip.x0)
+			x0 = clip.x0;
+		if (y0 < clip.y0)
+			y0 = clip.y0;
+		if (x1 > clip.x1)
+			x1 = clip.x1;
+		if (y1 > clip.y1)
+			y1 = clip.y1;
+	}
+	if (x0 > x1 || y0 > y1)
+		return;
+
+	unit_t *line = buffer + y0 * linelength;
+	size_t pixels = (size_t) (y1 - y0 + 1) * WIDTH;
+	if (x0 == 0 && x1 == WIDTH - 1 && linelength * sizeof(unit_t) * 8 == (size_t) WIDTH * F::BITS
+			&& pixels <= (size_t) INT32_MAX) {
+		// whole rows without padding are one run, e.g. clearScreen()
+		F::fill(line, 0, pixels - 1, color);
+		return;
+	}
+	for (coord_t y = y0; y <= y1; y++, line += linelength) {
+		F::fill(line, x0, x1, color);
+	}
+}
+
+template<class F>
+template<bool CLIP>
+inline void CanvasT<F>::putSpans(const span_t *spans, size_t n, color_t color) {
+	const rect_t r = clip;
+	unit_t * const buf = buffer;
+	const size_t ll = linelength;
+	for (const span_t *sp = spans, *end = spans + n; sp < end; sp++) {
+		coord_t x0 = sp->x0, x1 = sp->x1;
+		if (CLIP) {
+			if (sp->y < r.y0 || sp->y > r.y1)
+				continue;
+			if (x0 < r.x0)
+				x0 = r.x0;
+			if (x1 > r.x1)
+				x1 = r.x1;
+		}
+		if (x0 > x1)
+			continue;
+		F::fill(buf + sp->y * ll, x0, x1, color);
+	}
+}
+
+template<class F>
+template<bool CLIP>
+inline void CanvasT<F>::putBlend(coord_t x0, coord_t y0, coord_t x1, coord_t y1, unsigned level) {
+	if (CLIP) {
+		if (x0 < clip.x0)
+			x0 = clip.x0;
+		if (y0 < clip.y0)
+			y0 = clip.y0;
+		if (x1 > clip.x1)
+			x1 = clip.x1;
+		if (y1 > clip.y1)
+			y1 = clip.y1;
+	}
+	if (x0 > x1)
+		return;
+
+	unit_t *line = buffer + y0 * linelength;
+	for (coord_t y = y0; y <= y1; y++, line += linelength) {
+		blendTable.blend(line, x0, x1, level);
+	}
+}
+
+template<class F>
+color_t CanvasT<F>::mixColor(color_t dst, color_t src, unsigned a, unsigned max) {
+	return F::mix(dst, src, a, max);
+}
+
+template<class F>
+void CanvasT<F>::writePixel(coord_t x, coord_t y, color_t color) {
+	if (clipDamage(x, y, x, y) == CLIP_INSIDE)
+		putPixel<false>(x, y, color);
+}
+
+template<class F>
+void CanvasT<F>::writeHLine(coord_t x0, coord_t y0, coord_t x1, color_t color) {
+	damageRect(x0, y0, x1, y0);
+	putHLine<true>(x0, y0, x1, color);
+}
+
+template<class F>
+void CanvasT<F>::writeVLine(coord_t x0, coord_t y0, coord_t y1, color_t color) {
+	damageRect(x0, y0, x0, y1);
+	putVLine<true>(x0, y0, y1, color);
+}
+
+template<class F>
+void CanvasT<F>::writeSpans(const span_t *spans, size_t n, color_t color) {
+	if (n == 0)
+		return;
+	rect_t r = { spans[0].x0, spans[0].y, spans[0].x1, spans[0].y };
+	for (size_t i = 1; i < n; i++) {
+		r.x0 = std::min(r.x0, spans[i].x0);
+		r.x1 = std::max(r.x1, spans[i].x1);
+		r.y0 = std::min(r.y0, spans[i].y);
+		r.y1 = std::max(r.y1, spans[i].y);
+	}
+	ClipResult cr = clipDamage(r);
+	if (cr == CLIP_INSIDE)
+		putSpans<false>(spans, n, color);
+	else if (cr == CLIP_PARTIAL)
+		putSpans<true>(spans, n, color);
+}
+
+template<class F>
+void CanvasT<F>::writeFillRect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color) {
+	damageRect(x0, y0, x1, y1);
+	putRect<true>(x0, y0, x1, y1, color);
+}
+
+template<class F>
+void CanvasT<F>::writeLine(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color) {
+	coord_t bx0 = x0, by0 = y0, bx1 = x1, by1 = y1;
+	prim::sort(bx0, bx1);
+	prim::sort(by0, by1);
+
+	ClipResult cr = clipDamage(bx0, by0, bx1, by1);
+	if (cr == CLIP_INSIDE) {
+		Sink<false> sink = { *this };
+		prim::line(sink, x0, y0, x1, y1, color);
+	} else if (cr == CLIP_PARTIAL) {
+		Sink<true> sink = { *this };
+		prim::line(sink, x0, y0, x1, y1, color);
+	}
+}
+
+template<class F>
+void CanvasT<F>::writeCircle(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY, color_t color) {
+	ClipResult cr = clipDamage(x0 - r + std::min(deltaX, 0), y0 - r + std::min(deltaY, 0),
+			x0 + r + std::max(deltaX, 0), y0 + r + std::max(deltaY, 0));
+	if (cr == CLIP_INSIDE) {
+		Sink<false> sink = { *this };
+		prim::circle(sink, x0, y0, r, deltaX, deltaY, color);
+	} else if (cr == CLIP_PARTIAL) {
+		Sink<true> sink = { *this };
+		prim::circle(sink, x0, y0, r, deltaX, deltaY, color);
+	}
+}
+
+template<class F>
+void CanvasT<F>::writeFillCircle(coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY, color_t color) {
+	ClipResult cr = clipDamage(x0 - r + std::min(deltaX, 0), y0 - r + std::min(deltaY, 0),
+			x0 + r + std::max(deltaX, 0), y0 + r + std::max(deltaY, 0));
+	if (cr == CLIP_INSIDE) {
+		Sink<false> sink = { *this };
+		prim::fillCircle(sink, x0, y0, r, deltaX, deltaY, color);
+	} else if (cr == CLIP_PARTIAL) {
+		Sink<true> sink = { *this };
+		prim::fillCircle(sink, x0, y0, r, deltaX, deltaY, color);
+	}
+}
+
+template<class F>
+void CanvasT<F>::writeFillTriangle(coord_t x0, coord_t y0, coord_t x1, coord_t y1, coord_t x2, coord_t y2, color_t color) {
+	ClipResult cr = clipDamage(std::min(x0, std::min(x1, x2)), std::min(y0, std::min(y1, y2)),
+			std::max(x0, std::max(x1, x2)), std::max(y0, std::max(y1, y2)));
+	if (cr == CLIP_INSIDE) {
+		Sink<false> sink = { *this };
+		prim::fillTriangle(sink, x0, y0, x1, y1, x2, y2, color);
+	} else if (cr == CLIP_PARTIAL) {
+		Sink<true> sink = { *this };
+		prim::fillTriangle(sink, x0, y0, x1, y1, x2, y2, color);
+	}
+}
+
+template<class F>
+void CanvasT<F>::writeBitmap(coord_t x, coord_t y, const uint8_t *bitmap, size_t stride,
+		coord_t w, coord_t h, coord_t size, color_t color, color_t bg, bool opaque) {
+	ClipResult cr = clipDamage(bitmapBounds(x, y, w, h, size));
+	if (cr == CLIP_INSIDE) {
+		Sink<false> sink = { *this };
+		prim::bitmap(sink, x, y, mrot, bitmap, stride, w, h, size, color, bg, opaque);
+	} else if (cr == CLIP_PARTIAL) {
+		Sink<true> sink = { *this };
+		prim::bitmap(sink, x, y, mrot, bitmap, stride, w, h, size, color, bg, opaque);
+	}
+}
+
+template<class F>
+void CanvasT<F>::writeGlyph(coord_t x, coord_t y, const void *font, uint32_t code,
+		const uint8_t *bitmap, size_t stride, unsigned bpp, coord_t w, coord_t h, coord_t size,
+		color_t color, color_t bg, bool opaque) {
+	rect_t b = bitmapBounds(x, y, w, h, size);
+	ClipResult cr = clipDamage(b);
+	if (cr == CLIP_OUTSIDE)
+		return;
+	glyph_t g = { x, y, font, code, bitmap, stride, w, h, (uint8_t)bpp };
+	putGlyph(g, b, cr, size, color, bg, opaque);
+}
+
+template<class F>
+void CanvasT<F>::writeGlyphs(const glyph_t *glyphs, size_t n, const rect_t &bounds,
+		coord_t size, color_t color, color_t bg, bool opaque) {
+	ClipResult cr = clipTest(bounds);
+	if (cr == CLIP_OUTSIDE)
+		return;
+	if (cr == CLIP_INSIDE)
+		damageRect(bounds.x0, bounds.y0, bounds.x1, bounds.y1);
+
+	for (size_t i = 0; i < n; i++) {
+		const glyph_t &g = glyphs[i];
+		rect_t b = bitmapBounds(g.x, g.y, g.w, g.h, size);
+		// glyphs of a string inside the clip need no test of their own
+		ClipResult gcr = (cr == CLIP_INSIDE) ? CLIP_INSIDE : clipDamage(b);
+		if (gcr != CLIP_OUTSIDE)
+			putGlyph(g, b, gcr, size, color, bg, opaque);
+	}
+}
+
+template<class F>
+void CanvasT<F>::putGlyph(const glyph_t &gl, const rect_t &b, ClipResult cr,
+		coord_t size, color_t color, color_t bg, bool opaque) {
+	typedef GlyphCache<F> Cache;
+
+	// colors of the coverage levels of anti-aliased glyphs, transparent
+	// ones blend their partial levels with the canvas
+	const unsigned max = (1 << gl.bpp) - 1;
+	color_t ramp[16];
+	if (max > 1) {
+		if (opaque) {
+			textRamp(ramp, max, color, bg);
+		} else {
+			std::fill(ramp, ramp + max + 1, color);
+			blendTable.prepare(color, max);
+		}
+	}
+
+	if (max > 1 && !opaque && cr == CLIP_INSIDE) {
+		GlyphKey key = { gl.font, gl.code, size, 0, 0, false, getRotation(), 0 };
+		const GlyphCache<Format8bpp>::Glyph *lg = levelCache.find(key);
+		if (lg == NULL) {
+			GlyphCache<Format8bpp>::Glyph *ng = levelCache.insert(key, b.x1 - b.x0 + 1, b.y1 - b.y0 + 1);
+			if (ng != NULL) {
+				// rendered with the levels as colors
+				color_t levels[16];
+				for (unsigned a = 0; a <= max; a++)
+					levels[a] = a;
+				GlyphCache<Format8bpp>::Sink ls = { ng->data.data(), ng->data.data() + ng->rows * ng->units, ng->units };
+				const std::vector<run_t> &runs = glyphRuns(gl.font, gl.code, gl.bitmap, gl.stride, gl.bpp, gl.w, gl.h);
+				prim::levels<false>(ls, gl.x - b.x0, gl.y - b.y0, mrot, runs.data(), runs.size(), size,
+						levels, 1, max, false);
+				lg = ng;
+			}
+		}
+		if (lg != NULL) {
+			const uint8_t *lv = lg->pixels();
+			unit_t *line = buffer + b.y0 * linelength;
+			for (coord_t r = 0; r < lg->rows; r++, line += linelength, lv += lg->units)
+				blendTable.blend(line, b.x0, lv, (coord_t) lg->units);
+			return;
+		}
+	}
+
+	// the cached glyph starts at the storage unit containing b.x0
+	coord_t phase = b.x0 % Cache::PPU;
+	coord_t x0 = b.x0 - phase;
+	const typename Cache::Glyph *g = NULL;
+	if (cr == CLIP_INSIDE && (max == 1 || opaque)) {
+		GlyphKey key = { gl.font, gl.code, size, color, opaque ? bg : 0, opaque,
+				getRotation(), (uint8_t)phase };
+		g = glyphCache.find(key);
+		if (g == NULL) {
+			typename Cache::Glyph *ng = glyphCache.insert(key, b.x1 - x0 + 1, b.y1 - b.y0 + 1);
+			if (ng != NULL) {
+				typename Cache::Sink gs = { ng->data.data(), ng->data.data() + ng->rows * ng->units, ng->units };
+				const std::vector<run_t> &runs = glyphRuns(gl.font, gl.code, gl.bitmap, gl.stride, gl.bpp, gl.w, gl.h);
+				if (max > 1)
+					prim::levels<false>(gs, gl.x - x0, gl.y - b.y0, mrot, runs.data(), runs.size(), size,
+							ramp, 1, max, true);
+				else
+					prim::runs(gs, gl.x - x0, gl.y - b.y0, mrot, runs.data(), runs.size(), size, color, bg, opaque);
+				Cache::finish(*ng);
+				g = ng;
+			}
+		}
+	}
+
+	if (g == NULL) {
+		// clipped or too large to cache, draw the runs directly
+		const std::vector<run_t> &runs = glyphRuns(gl.font, gl.code, gl.bitmap, gl.stride, gl.bpp, gl.w, gl.h);
+		if (max > 1) {
+			if (cr == CLIP_INSIDE) {
+				Sink<false> sink = { *this };
+				prim::levels<true>(sink, gl.x, gl.y, mrot, runs.data(), runs.size(), size, ramp, 1, max, opaque);
+			} else {
+				Sink<true> sink = { *this };
+				prim::levels<true>(sink, gl.x, gl.y, mrot, runs.data(), runs.size(), size, ramp, 1, max, opaque);
+			}
+		} else if (cr == CLIP_INSIDE) {
+			Sink<false> sink = { *this };
+			prim::runs(sink, gl.x, gl.y, mrot, runs.data(), runs.size(), size, color, bg, opaque);
+		} else {
+			Sink<true> sink = { *this };
+			prim::runs(sink, gl.x, gl.y, mrot, runs.data(), runs.size(), size, color, bg, opaque);
+		}
+		return;
+	}
+
+	const size_t bytes = g->units * sizeof(unit_t);
+	const uint8_t *pix = (const uint8_t*)g->pixels();
+	const uint8_t *mask = (const uint8_t*)g->mask();
+	unit_t *line = buffer + b.y0 * linelength + x0 / Cache::PPU;
+	for (coord_t r = 0; r < g->rows; r++, line += linelength, pix += bytes, mask += bytes) {
+		if (g->solid)
+			std::memcpy(line, pix, bytes);
+		else
+			blitMasked((uint8_t*)line, pix, mask, bytes);
+	}
+}
+
+}
+
+#endif // _CANVAS_T_H_
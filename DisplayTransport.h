@@ -0,0 +1,40 @@
+#ifndef _DISPLAYTRANSPORT_H_
+#define _DISPLAYTRANSPORT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace GFX {
+
+// Connection to a display controller: reset line, data/command line and
+// a serial bus.  Not thread safe.  A display uses it from its refresh
+// thread while that runs, and from the caller's thread in enable(),
+// disable() and its destructor before the refresh thread is started or
+// after it is joined.  Nothing else may call it while the refresh thread
+// of a display using it runs.
+class DisplayTransport {
+public:
+	virtual ~DisplayTransport() {
+		//nothing
+	}
+
+	// Drive the reset line, low holds the controller in reset
+	virtual void setReset(bool high) = 0;
+	// Drive the D/C line, low selects commands, high display data
+	virtual void setDC(bool high) = 0;
+	// Shift out len bytes
+	virtual void transfer(const uint8_t *buf, size_t len) = 0;
+
+	void writeCommand(const uint8_t *cmd, size_t len) {
+		setDC(false);
+		transfer(cmd, len);
+	}
+	void writeData(const uint8_t *data, size_t len) {
+		setDC(true);
+		transfer(data, len);
+	}
+};
+
+}
+
+#endif // _DISPLAYTRANSPORT_H_
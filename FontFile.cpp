@@ -0,0 +1,128 @@
+#include "FontFile.h"
+#include "Canvas.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace GFX;
+
+FontFile::FontFile(const char *path) : map(MAP_FAILED), length(0), header(NULL) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error(std::string("can not open font file ") + path);
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		length = st.st_size;
+		map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd); // the mapping stays valid
+	if (map == MAP_FAILED)
+		throw std::runtime_error(std::string("can not map font file ") + path);
+
+	try {
+		check(path);
+	} catch (...) {
+		munmap(map, length);
+		throw;
+	}
+}
+
+FontFile::~FontFile() {
+	munmap(map, length);
+	// the next file may be mapped at the same address
+	Canvas::forgetFonts();
+}
+
+// Validate everything the drawing code indexes without checks, so a
+// broken file is rejected here instead of reading outside the mapping
+void FontFile::check(const char *path) {
+	std::string error = std::string("invalid font file ") + path;
+	if (length < sizeof(GFXfontFile))
+		throw std::runtime_error(error);
+	header = (const GFXfontFile *) map;
+	if (header->magic != GFX_FILE_MAGIC || header->version != GFX_FILE_VERSION
+			|| !memchr(header->name, 0, sizeof(header->name)))
+		throw std::runtime_error(error);
+	for (unsigned s = 0; s < GFX_FILE_SECTIONS; s++) {
+		uint32_t offset = header->offset[s], len = header->length[s];
+		if (len && (offset % 4 || offset < sizeof(GFXfontFile) || offset > length
+				|| len > length - offset))
+			throw std::runtime_error(error);
+	}
+	uint32_t bitmapLength = header->length[GFX_FILE_BITMAP];
+
+	if (header->format == 1) {
+		if (header->first > header->last || header->last > 0xFF
+				|| header->length[GFX_FILE_GLYPHS]
+						!= (header->last - header->first + 1) * sizeof(GFXglyph))
+			throw std::runtime_error(error);
+		const GFXglyph *glyphs = (const GFXglyph *) section(GFX_FILE_GLYPHS);
+		for (unsigned i = 0; i <= (unsigned) (header->last - header->first); i++) {
+			const GFXglyph &g = glyphs[i];
+			if (g.bitmapOffset + (g.width * g.height + 7u) / 8 > bitmapLength)
+				throw std::runtime_error(error);
+		}
+		font.bitmap = (uint8_t *) section(GFX_FILE_BITMAP);
+		font.glyph = (GFXglyph *) glyphs;
+		font.first = header->first;
+		font.last = header->last;
+		font.yAdvance = header->yAdvance;
+		return;
+	}
+
+	unsigned bpp = header->bpp ? header->bpp : 1;
+	uint32_t n = header->glyphCount;
+	uint32_t blocks = header->length[GFX_FILE_INDEX] / (256 * sizeof(uint16_t));
+	if (header->format != 2 || (bpp != 1 && bpp != 2 && bpp != 4) || n == 0
+			|| header->length[GFX_FILE_GLYPHS] != n * sizeof(GFXglyph2)
+			|| header->pageCount == 0
+			|| header->length[GFX_FILE_PAGES] != header->pageCount * sizeof(uint16_t)
+			|| header->length[GFX_FILE_INDEX] != blocks * 256 * sizeof(uint16_t))
+		throw std::runtime_error(error);
+	const GFXglyph2 *glyphs = (const GFXglyph2 *) section(GFX_FILE_GLYPHS);
+	for (uint32_t i = 0; i < n; i++) {
+		const GFXglyph2 &g = glyphs[i];
+		if (g.bitmapOffset > bitmapLength
+				|| ((uint64_t) g.width * g.height * bpp + 7) / 8 > bitmapLength - g.bitmapOffset)
+			throw std::runtime_error(error);
+	}
+	const uint16_t *pages = (const uint16_t *) section(GFX_FILE_PAGES);
+	for (unsigned i = 0; i < header->pageCount; i++) {
+		if (pages[i] > blocks)
+			throw std::runtime_error(error);
+	}
+	const uint16_t *index = (const uint16_t *) section(GFX_FILE_INDEX);
+	for (uint32_t i = 0; i < blocks * 256; i++) {
+		if (index[i] > n)
+			throw std::runtime_error(error);
+	}
+	const uint32_t *pairs = (const uint32_t *) section(GFX_FILE_KERN_PAIRS);
+	uint32_t kerns = header->kernCount;
+	if (kerns && (header->length[GFX_FILE_KERN_PAIRS] != kerns * sizeof(uint32_t)
+			|| header->length[GFX_FILE_KERN_AMOUNTS] != kerns
+			|| header->length[GFX_FILE_KERN_FILTER] != 2 * ((n + 7) / 8)))
+		throw std::runtime_error(error);
+	for (uint32_t i = 0; i < kerns; i++) {
+		if ((pairs[i] >> 16) >= n || (pairs[i] & 0xFFFF) >= n || (i > 0 && pairs[i] <= pairs[i - 1]))
+			throw std::runtime_error(error);
+	}
+
+	font2.bitmap = (uint8_t *) section(GFX_FILE_BITMAP);
+	font2.glyph = (GFXglyph2 *) glyphs;
+	font2.pages = (uint16_t *) pages;
+	font2.index = (uint16_t *) index;
+	font2.pageCount = header->pageCount;
+	font2.glyphCount = n;
+	font2.yAdvance = header->yAdvance;
+	font2.bpp = header->bpp;
+	font2.kernCount = kerns;
+	font2.kernPairs = (uint32_t *) pairs;
+	font2.kernAmounts = (int8_t *) section(GFX_FILE_KERN_AMOUNTS);
+	font2.kernFilter = (uint8_t *) section(GFX_FILE_KERN_FILTER);
+}
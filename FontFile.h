@@ -0,0 +1,59 @@
+#ifndef _FONTFILE_H_
+#define _FONTFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "gfxfont.h"
+
+namespace GFX {
+
+// Binary font file written by fontconvert -b (see GFXfontFile in
+// gfxfont.h), mapped read-only into memory.  The font structure points
+// into the mapping, nothing is copied and pages are only read when glyphs
+// are drawn.  The font must not be used after the FontFile is destroyed,
+// which makes canvases drop what they cached about it (see
+// Canvas::forgetFonts()).
+class FontFile {
+public:
+	// throws std::runtime_error if the file can not be mapped or is not
+	// a valid font file
+	explicit FontFile(const char *path);
+	~FontFile();
+
+	FontFile(const FontFile &) = delete;
+	FontFile &operator=(const FontFile &) = delete;
+
+	// Font name without the size, e.g. "FreeSans"
+	const char *getName() const {
+		return header->name;
+	}
+	// Point size, 0 for pixel fonts
+	uint16_t getSize() const {
+		return header->size;
+	}
+	// Version 1 font, NULL for version 2 files
+	const GFXfont *getFont() const {
+		return header->format == 1 ? &font : NULL;
+	}
+	// Version 2 font, NULL for version 1 files
+	const GFXfont2 *getFont2() const {
+		return header->format == 2 ? &font2 : NULL;
+	}
+
+private:
+	void check(const char *path);
+	const uint8_t *section(unsigned s) const {
+		return header->length[s] ? (const uint8_t *) map + header->offset[s] : NULL;
+	}
+
+	void *map;
+	size_t length;
+	const GFXfontFile *header;
+	GFXfont font;
+	GFXfont2 font2;
+};
+
+}
+
+#endif // _FONTFILE_H_
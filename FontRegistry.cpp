@@ -0,0 +1,65 @@
+#include "FontRegistry.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <dirent.h>
+
+using namespace GFX;
+
+void FontRegistry::add(const std::string &name, uint16_t size, const GFXfont *font) {
+	Entry e = { name, size, font, NULL };
+	entries.insert(std::make_pair(name, e));
+}
+
+void FontRegistry::add(const std::string &name, uint16_t size, const GFXfont2 &font) {
+	Entry e = { name, size, NULL, &font };
+	entries.insert(std::make_pair(name, e));
+}
+
+const FontRegistry::Entry &FontRegistry::load(const char *path) {
+	files.emplace_back(new FontFile(path));
+	const FontFile &f = *files.back();
+	Entry e = { f.getName(), f.getSize(), f.getFont(), f.getFont2() };
+	return entries.insert(std::make_pair(e.name, e))->second;
+}
+
+size_t FontRegistry::loadDirectory(const char *dir) {
+	DIR *d = opendir(dir);
+	if (d == NULL)
+		throw std::runtime_error(std::string("can not read font directory ") + dir);
+	std::vector<std::string> names;
+	while (struct dirent *de = readdir(d)) {
+		std::string name = de->d_name;
+		if (name.size() > 4 && name.compare(name.size() - 4, 4, ".gfx") == 0)
+			names.push_back(name);
+	}
+	closedir(d);
+
+	std::sort(names.begin(), names.end());
+	for (size_t i = 0; i < names.size(); i++) {
+		load((std::string(dir) + "/" + names[i]).c_str());
+	}
+	return names.size();
+}
+
+const FontRegistry::Entry *FontRegistry::find(const std::string &name, uint16_t size) const {
+	std::pair<std::multimap<std::string, Entry>::const_iterator,
+			std::multimap<std::string, Entry>::const_iterator> range = entries.equal_range(name);
+	for (std::multimap<std::string, Entry>::const_iterator it = range.first; it != range.second; ++it) {
+		if (size == 0 || it->second.size == size)
+			return &it->second;
+	}
+	return NULL;
+}
+
+bool FontRegistry::setFont(Canvas &canvas, const std::string &name, uint16_t size) const {
+	const Entry *e = find(name, size);
+	if (e == NULL)
+		return false;
+	if (e->font2)
+		canvas.setFont(*e->font2);
+	else
+		canvas.setFont(e->font);
+	return true;
+}
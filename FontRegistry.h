@@ -0,0 +1,55 @@
+#ifndef _FONTREGISTRY_H_
+#define _FONTREGISTRY_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Canvas.h"
+#include "FontFile.h"
+#include "gfxfont.h"
+
+namespace GFX {
+
+// Fonts looked up by name and point size, e.g. ("FreeSans", 12), from
+// font files loaded at run time and from fonts compiled into the program.
+// Several fonts may share a name and size (e.g. a 1 bpp and an
+// anti-aliased one), lookups return the one added first.
+class FontRegistry {
+public:
+	struct Entry {
+		std::string name;
+		uint16_t size;
+		const GFXfont *font;   // version 1 font or NULL
+		const GFXfont2 *font2; // version 2 font or NULL
+	};
+
+	void add(const std::string &name, uint16_t size, const GFXfont *font);
+	void add(const std::string &name, uint16_t size, const GFXfont2 &font);
+	// Add the fonts in Fonts/, only available if they are compiled into
+	// the library (CMake option GFX_BUILTIN_FONTS).  Pixel fonts without
+	// a point size are added with size 0.
+	void addBuiltinFonts();
+
+	// Map a font file and add its font, the file stays mapped while the
+	// registry exists.  throws std::runtime_error like FontFile.
+	const Entry &load(const char *path);
+	// Load all *.gfx files in dir in name order, returns the number of
+	// fonts loaded.  throws std::runtime_error if dir can not be read.
+	size_t loadDirectory(const char *dir);
+
+	// Font of name and size, of any size if size is 0.  NULL if there is
+	// none.  Entries stay valid while the registry exists.
+	const Entry *find(const std::string &name, uint16_t size = 0) const;
+	// Select a font of name and size into canvas, false if there is none
+	bool setFont(Canvas &canvas, const std::string &name, uint16_t size = 0) const;
+
+private:
+	std::multimap<std::string, Entry> entries;
+	std::vector<std::unique_ptr<FontFile> > files;
+};
+
+}
+
+#endif // _FONTREGISTRY_H_
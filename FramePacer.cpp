@@ -0,0 +1,69 @@
+#include "FramePacer.h"
+
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+
+using namespace GFX;
+
+FramePacer::FramePacer(double hz) : spin(0) {
+	setRate(hz);
+}
+
+std::chrono::nanoseconds FramePacer::periodOf(double hz) {
+	// rates so high or low the period rounds to 0 or overflows are
+	// rejected too
+	double ns = std::isfinite(hz) && hz > 0 ? 1e9 / hz + 0.5 : 0;
+	if (!(ns >= 1 && ns < (double) INT64_MAX))
+		throw std::invalid_argument("invalid frame rate");
+	return std::chrono::nanoseconds((int64_t) ns);
+}
+
+void FramePacer::setRate(double hz) {
+	setPeriod(periodOf(hz));
+}
+
+void FramePacer::setPeriod(std::chrono::nanoseconds period) {
+	if (period.count() <= 0)
+		throw std::invalid_argument("invalid frame period");
+	this->period = period;
+	start();
+}
+
+void FramePacer::setSpin(std::chrono::nanoseconds spin) {
+	this->spin = spin;
+}
+
+void FramePacer::start() {
+	epoch = clock::now();
+	frame = 0;
+	lateFrames = 0;
+	missedFrames = 0;
+	maxLateness = std::chrono::nanoseconds(0);
+}
+
+bool FramePacer::wait() {
+	frame++;
+	clock::time_point deadline = epoch + period * frame;
+	clock::time_point now = clock::now();
+
+	if (now >= deadline) {
+		std::chrono::nanoseconds lateness = now - deadline;
+		lateFrames++;
+		if (lateness > maxLateness)
+			maxLateness = lateness;
+		// keep the phase, continue with the next deadline still ahead
+		int64_t behind = lateness / period;
+		frame += behind;
+		missedFrames += behind;
+		return false;
+	}
+
+	if (deadline - now > spin)
+		std::this_thread::sleep_until(deadline - spin);
+	while (clock::now() < deadline) {
+		//spin
+	}
+	return true;
+}
@@ -0,0 +1,70 @@
+#ifndef _FRAMEPACER_H_
+#define _FRAMEPACER_H_
+
+#include <chrono>
+#include <cstdint>
+
+namespace GFX {
+
+// Paces a loop to a fixed frame rate.  Deadlines are computed from the
+// epoch set by start() as epoch + n * period, so errors of individual
+// sleeps do not accumulate.  A frame is late if its deadline has already
+// passed when wait() is called; deadlines missed completely are skipped
+// instead of being caught up in a burst.
+class FramePacer {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	FramePacer(double hz = 60.0);
+
+	// throw std::invalid_argument unless the period is positive and the
+	// rate positive and finite
+	void setRate(double hz);
+	void setPeriod(std::chrono::nanoseconds period);
+	// Period of the rate hz rounded to whole ns, checked like setRate()
+	static std::chrono::nanoseconds periodOf(double hz);
+	// Busy-wait for the last part of each frame instead of sleeping, the
+	// wakeup latency of sleep_until is often several 100us.
+	void setSpin(std::chrono::nanoseconds spin);
+
+	std::chrono::nanoseconds getPeriod() const {
+		return period;
+	}
+	std::chrono::nanoseconds getSpin() const {
+		return spin;
+	}
+
+	// Set the epoch to now and reset the statistics
+	void start();
+	// Wait for the deadline of the next frame.  Returns false without
+	// waiting if the frame is late.
+	bool wait();
+
+	// Frames since start(), including skipped ones
+	int64_t getFrame() const {
+		return frame;
+	}
+	uint32_t getLateFrames() const {
+		return lateFrames;
+	}
+	// Deadlines skipped because a frame was late by more than a period
+	uint32_t getMissedFrames() const {
+		return missedFrames;
+	}
+	std::chrono::nanoseconds getMaxLateness() const {
+		return maxLateness;
+	}
+
+private:
+	clock::time_point epoch;
+	std::chrono::nanoseconds period;
+	std::chrono::nanoseconds spin;
+	int64_t frame;
+	uint32_t lateFrames;
+	uint32_t missedFrames;
+	std::chrono::nanoseconds maxLateness;
+};
+
+}
+
+#endif // _FRAMEPACER_H_
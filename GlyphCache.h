@@ -0,0 +1,241 @@
+#ifndef _GLYPHCACHE_H_
+#define _GLYPHCACHE_H_
+
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "PixelFormat.h"
+#include "Primitives.h"
+
+namespace GFX {
+
+// Identifies a rendered glyph: which glyph of which font, drawn how.
+// font is the GFXfont or NULL for the classic font, code the glyph index
+// resp. character.  Colors are native pixel values, bg is 0 if not
+// opaque.  phase is the device x of the glyph modulo the pixels per
+// storage unit, so sub-byte formats get one entry per bit alignment.
+struct GlyphKey {
+	const void *font;
+	uint32_t code;
+	coord_t size;
+	color_t fg;
+	color_t bg;
+	bool opaque;
+	uint8_t rotation;
+	uint8_t phase;
+
+	bool operator==(const GlyphKey &o) const {
+		return font == o.font && code == o.code && size == o.size && fg == o.fg
+				&& bg == o.bg && opaque == o.opaque && rotation == o.rotation
+				&& phase == o.phase;
+	}
+};
+
+struct GlyphKeyHash {
+	size_t operator()(const GlyphKey &k) const {
+		size_t h = (size_t)k.font;
+		h = h * 31 + k.code;
+		h = h * 31 + k.size;
+		h = h * 31 + k.fg;
+		h = h * 31 + k.bg;
+		h = h * 31 + ((k.opaque << 16) | (k.rotation << 8) | k.phase);
+		return h;
+	}
+};
+
+// dst = (dst & ~mask) | (src & mask) over n bytes, 8 bytes at a time
+inline void blitMasked(uint8_t *dst, const uint8_t *src, const uint8_t *mask, size_t n) {
+	for (; n >= 8; n -= 8, dst += 8, src += 8, mask += 8) {
+		uint64_t d, s, m;
+		std::memcpy(&d, dst, 8);
+		std::memcpy(&s, src, 8);
+		std::memcpy(&m, mask, 8);
+		d = (d & ~m) | (s & m);
+		std::memcpy(dst, &d, 8);
+	}
+	for (; n > 0; n--, dst++, src++, mask++) {
+		*dst = (*dst & ~*mask) | (*src & *mask);
+	}
+}
+
+// Glyphs pre-rendered in the pixel format F of a canvas.  Each glyph is
+// stored as rows laid out exactly like the canvas memory they cover, plus
+// a mask with all bits of the covered pixels set, so drawing it is a
+// masked copy of whole rows.  The cache is emptied when it would grow
+// beyond its limit.
+template<class F>
+class GlyphCache {
+public:
+	typedef typename F::unit_t unit_t;
+
+	// pixels per storage unit
+	static const unsigned PPU = 8 * sizeof(unit_t) / F::BITS;
+
+	struct Glyph {
+		coord_t rows;
+		size_t units;  // storage units per row
+		bool solid;    // every pixel is covered, the mask can be ignored
+		std::vector<unit_t> data; // rows of pixels, then rows of the mask
+
+		const unit_t *pixels() const {
+			return data.data();
+		}
+		const unit_t *mask() const {
+			return data.data() + rows * units;
+		}
+	};
+
+	// Renders a glyph with the algorithms in Primitives.h
+	struct Sink {
+		unit_t *pix;
+		unit_t *mask;
+		size_t units;
+
+		void pixel(coord_t x, coord_t y, color_t color) {
+			F::put(pix + y * units, x, color);
+			F::put(mask + y * units, x, ~(color_t)0);
+		}
+		void hline(coord_t x0, coord_t y, coord_t x1, color_t color) {
+			F::fill(pix + y * units, x0, x1, color);
+			F::fill(mask + y * units, x0, x1, ~(color_t)0);
+		}
+		void vline(coord_t x, coord_t y0, coord_t y1, color_t color) {
+			for (coord_t y = y0; y <= y1; y++)
+				pixel(x, y, color);
+		}
+		void rect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color) {
+			for (coord_t y = y0; y <= y1; y++)
+				hline(x0, y, x1, color);
+		}
+		void spans(const span_t *spans, size_t n, color_t color) {
+			for (size_t i = 0; i < n; i++)
+				hline(spans[i].x0, spans[i].y, spans[i].x1, color);
+		}
+	};
+
+	GlyphCache(size_t limit) : used(0), limit(limit) {
+		//nothing
+	}
+
+	void setLimit(size_t bytes) {
+		limit = bytes;
+		if (used > limit)
+			clear();
+	}
+	size_t getLimit() const {
+		return limit;
+	}
+	void clear() {
+		glyphs.clear();
+		used = 0;
+	}
+
+	const Glyph *find(const GlyphKey &key) const {
+		typename std::unordered_map<GlyphKey, Glyph, GlyphKeyHash>::const_iterator it = glyphs.find(key);
+		return it == glyphs.end() ? NULL : &it->second;
+	}
+
+	// New cleared glyph of width pixels, NULL if it is too large to cache
+	Glyph *insert(const GlyphKey &key, coord_t width, coord_t rows) {
+		size_t units = F::lineLength(width);
+		size_t bytes = 2 * rows * units * sizeof(unit_t);
+		// large scaled glyphs would evict everything else, they are
+		// drawn from run lists instead
+		if (bytes > limit / 8)
+			return NULL;
+		if (used + bytes > limit)
+			clear();
+		used += bytes;
+
+		Glyph &g = glyphs[key];
+		g.rows = rows;
+		g.units = units;
+		g.solid = false;
+		g.data.assign(2 * rows * units, 0);
+		return &g;
+	}
+
+	// Set solid if the mask covers every pixel of every row
+	static void finish(Glyph &g) {
+		const unit_t *m = g.mask();
+		g.solid = true;
+		for (size_t i = 0; i < g.rows * g.units; i++) {
+			if (m[i] != (unit_t)~(unit_t)0) {
+				g.solid = false;
+				break;
+			}
+		}
+	}
+
+private:
+	std::unordered_map<GlyphKey, Glyph, GlyphKeyHash> glyphs;
+	size_t used;
+	size_t limit;
+};
+
+// Run lists of glyph bitmaps (see prim::scanRuns() and prim::scanLevels()),
+// keyed by font and glyph only since runs are independent of scale,
+// rotation and colors.
+// Holds at most 'limit' runs, it is emptied when full.
+class RunCache {
+public:
+	RunCache(size_t limit) : used(0), limit(limit) {
+		//nothing
+	}
+
+	void clear() {
+		lists.clear();
+		used = 0;
+	}
+
+	// Runs of the glyph of bpp bits per pixel, valid until the next call
+	const std::vector<run_t> &get(const void *font, uint32_t code,
+			const uint8_t *bits, size_t stride, unsigned bpp, coord_t w, coord_t h) {
+		Key key = { font, code };
+		std::unordered_map<Key, std::vector<run_t>, KeyHash>::iterator it = lists.find(key);
+		if (it != lists.end())
+			return it->second;
+
+		if (used > limit)
+			clear();
+		std::vector<run_t> &runs = lists[key];
+		Collect collect = { runs };
+		if (bpp > 1)
+			prim::scanLevels(bits, stride, bpp, w, h, collect);
+		else
+			prim::scanRuns(bits, stride, w, h, collect);
+		used += runs.size();
+		return runs;
+	}
+
+private:
+	struct Key {
+		const void *font;
+		uint32_t code;
+
+		bool operator==(const Key &o) const {
+			return font == o.font && code == o.code;
+		}
+	};
+	struct KeyHash {
+		size_t operator()(const Key &k) const {
+			return (size_t)k.font * 31 + k.code;
+		}
+	};
+	struct Collect {
+		std::vector<run_t> &runs;
+		void operator()(coord_t y, coord_t x0, coord_t x1, unsigned level) {
+			run_t r = { y, x0, x1, (uint8_t)level };
+			runs.push_back(r);
+		}
+	};
+
+	std::unordered_map<Key, std::vector<run_t>, KeyHash> lists;
+	size_t used;
+	size_t limit;
+};
+
+}
+
+#endif // _GLYPHCACHE_H_
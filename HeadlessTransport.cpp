@@ -0,0 +1,82 @@
+#include "HeadlessTransport.h"
+
+#include <stdexcept>
+#include <thread>
+
+using namespace GFX;
+
+HeadlessTransport::HeadlessTransport(uint32_t clock)
+	: clock(clock), dc(false), recordMode(RECORD_NONE), file(NULL),
+	  transfers(0), commandBytes(0), dataBytes(0), busyTime(0) {
+	//nothing
+}
+
+HeadlessTransport::~HeadlessTransport() {
+	stopRecording();
+}
+
+void HeadlessTransport::setClock(uint32_t clock) {
+	this->clock = clock;
+}
+
+void HeadlessTransport::recordToMemory() {
+	stopRecording();
+	recordMode = RECORD_MEMORY;
+}
+
+void HeadlessTransport::recordToFile(const char *path) {
+	stopRecording();
+	file = fopen(path, "wb");
+	if (file == NULL)
+		throw std::runtime_error("can not open transport record file");
+	recordMode = RECORD_FILE;
+}
+
+void HeadlessTransport::stopRecording() {
+	if (file != NULL) {
+		fclose(file);
+		file = NULL;
+	}
+	recordMode = RECORD_NONE;
+}
+
+void HeadlessTransport::record(char type, const uint8_t *buf, size_t len) {
+	uint8_t header[5] = {
+		(uint8_t)type,
+		(uint8_t)len,
+		(uint8_t)(len >> 8),
+		(uint8_t)(len >> 16),
+		(uint8_t)(len >> 24),
+	};
+	if (recordMode == RECORD_MEMORY) {
+		log.insert(log.end(), header, header + sizeof(header));
+		log.insert(log.end(), buf, buf + len);
+	} else if (recordMode == RECORD_FILE) {
+		fwrite(header, 1, sizeof(header), file);
+		fwrite(buf, 1, len, file);
+	}
+}
+
+void HeadlessTransport::setReset(bool high) {
+	uint8_t level = high;
+	record('R', &level, 1);
+}
+
+void HeadlessTransport::setDC(bool high) {
+	dc = high;
+}
+
+void HeadlessTransport::transfer(const uint8_t *buf, size_t len) {
+	record(dc ? 'D' : 'C', buf, len);
+	transfers++;
+	if (dc)
+		dataBytes += len;
+	else
+		commandBytes += len;
+
+	if (clock == 0)
+		return;
+	std::chrono::nanoseconds duration((int64_t)len * 8 * 1000000000 / clock);
+	busyTime += duration.count();
+	std::this_thread::sleep_until(std::chrono::steady_clock::now() + duration);
+}
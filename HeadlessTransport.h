@@ -0,0 +1,80 @@
+#ifndef _HEADLESSTRANSPORT_H_
+#define _HEADLESSTRANSPORT_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "DisplayTransport.h"
+
+namespace GFX {
+
+// Transport without hardware.  Transfers block for the time they would
+// take on an SPI bus with the configured clock, so the refresh pipeline
+// can be run and profiled on any machine, and can be recorded to memory
+// or to a file.  A record is one type byte ('R' reset, 'C' command, 'D'
+// data), the payload length as 32-bit little endian and the payload; the
+// payload of a reset record is the new line level.
+class HeadlessTransport : public DisplayTransport {
+public:
+	// clock 0 makes transfers instantaneous
+	HeadlessTransport(uint32_t clock = 32 * 1000 * 1000);
+	virtual ~HeadlessTransport();
+
+	void setClock(uint32_t clock);
+
+	void recordToMemory();
+	// throws std::runtime_error if the file can not be opened
+	void recordToFile(const char *path);
+	void stopRecording();
+	// Recorded log, only to be read while the display is disabled
+	const std::vector<uint8_t> &getLog() const {
+		return log;
+	}
+	void clearLog() {
+		log.clear();
+	}
+
+	uint64_t getTransfers() const {
+		return transfers;
+	}
+	uint64_t getCommandBytes() const {
+		return commandBytes;
+	}
+	uint64_t getDataBytes() const {
+		return dataBytes;
+	}
+	// Total time the modeled bus was busy
+	std::chrono::nanoseconds getBusyTime() const {
+		return std::chrono::nanoseconds(busyTime);
+	}
+
+	virtual void setReset(bool high);
+	virtual void setDC(bool high);
+	virtual void transfer(const uint8_t *buf, size_t len);
+
+private:
+	enum RecordMode {
+		RECORD_NONE,
+		RECORD_MEMORY,
+		RECORD_FILE,
+	};
+
+	uint32_t clock;
+	bool dc;
+	RecordMode recordMode;
+	std::vector<uint8_t> log;
+	FILE *file;
+
+	std::atomic<uint64_t> transfers;
+	std::atomic<uint64_t> commandBytes;
+	std::atomic<uint64_t> dataBytes;
+	std::atomic<int64_t> busyTime;
+
+	void record(char type, const uint8_t *buf, size_t len);
+};
+
+}
+
+#endif // _HEADLESSTRANSPORT_H_
@@ -0,0 +1,57 @@
+#include "MraaTransport.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include <mraa/common.hpp>
+
+using namespace GFX;
+
+static void mR(mraa::Result r) {
+	if (r != mraa::SUCCESS) {
+		mraa::printError(r);
+		throw std::invalid_argument("MRAA error");
+	}
+}
+
+static void mraa_dir_retry(mraa::Gpio &gpio, mraa::Dir dir) {
+	while (gpio.dir(dir) != mraa::SUCCESS) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+}
+
+MraaTransport::MraaTransport(int rstPin, int dcPin, int spiBus, int spiCs, int frequency)
+	: rst(rstPin), dc(dcPin), spi(spiBus, spiCs) {
+	//GPIO Init
+	mraa_dir_retry(rst, mraa::DIR_OUT);
+	mraa_dir_retry(dc, mraa::DIR_OUT);
+	mR(rst.write(0));
+	mR(dc.write(0));
+
+	mR(spi.mode(mraa::SPI_MODE0));
+	mR(spi.frequency(frequency));
+	mR(spi.bitPerWord(8));
+	mR(spi.lsbmode(false));
+}
+
+// The line and transfer calls below run on the refresh thread and in
+// destructors, errors are reported but not thrown.
+
+void MraaTransport::setReset(bool high) {
+	mraa::Result r = rst.write(high ? 1 : 0);
+	if (r != mraa::SUCCESS)
+		mraa::printError(r);
+}
+
+void MraaTransport::setDC(bool high) {
+	mraa::Result r = dc.write(high ? 1 : 0);
+	if (r != mraa::SUCCESS)
+		mraa::printError(r);
+}
+
+void MraaTransport::transfer(const uint8_t *buf, size_t len) {
+	mraa::Result r = spi.transfer(const_cast<uint8_t*>(buf), NULL, len);
+	if (r != mraa::SUCCESS)
+		mraa::printError(r);
+}
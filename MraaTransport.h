@@ -0,0 +1,29 @@
+#ifndef _MRAATRANSPORT_H_
+#define _MRAATRANSPORT_H_
+
+#include <mraa/gpio.hpp>
+#include <mraa/spi.hpp>
+
+#include "DisplayTransport.h"
+
+namespace GFX {
+
+// Display connected to SPI and two GPIOs through libmraa
+class MraaTransport : public DisplayTransport {
+private:
+	mraa::Gpio rst; // Reset
+	mraa::Gpio dc; // Data/Command
+	mraa::Spi spi;
+
+public:
+	MraaTransport(int rstPin = 15, int dcPin = 29, int spiBus = 0, int spiCs = 0,
+			int frequency = 32 * 1000 * 1000);
+
+	virtual void setReset(bool high);
+	virtual void setDC(bool high);
+	virtual void transfer(const uint8_t *buf, size_t len);
+};
+
+}
+
+#endif // _MRAATRANSPORT_H_
@@ -1,72 +1,72 @@
 #include "OLEDDisplay.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <cstring>
 #include <iostream>
 
-#include <mraa/common.hpp>
+#ifdef GFX_HAVE_MRAA
+#include "MraaTransport.h"
+#else
+#include "HeadlessTransport.h"
+#endif
 
 using namespace GFX;
 
+#ifdef GFX_HAVE_MRAA
+typedef MraaTransport DefaultTransport;
+#else
+typedef HeadlessTransport DefaultTransport;
+#endif
 
-
-static void mR(mraa::Result r) {
-	if (r != mraa::SUCCESS) {
-		mraa::printError(r);
-		throw std::invalid_argument("MRAA error");
-	}
+OLEDDisplay::OLEDDisplay(coord_t width, coord_t height)
+	: Canvas4bpp(width, height, NULL), ownTransport(new DefaultTransport()),
+	  transport(*ownTransport), refreshTerminate(false),
+	  refreshMode(REFRESH_CONTINUOUS), frameCounter(0), skipCounter(0),
+	  emptyFlushCounter(0), framePeriod(0), spinTime(0), lateCounter(0) {
+	init();
 }
 
-static void mraa_dir_retry(mraa::Gpio &gpio, mraa::Dir dir) {
-	while (gpio.dir(dir) != mraa::SUCCESS) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
-	}
+OLEDDisplay::OLEDDisplay(coord_t width, coord_t height, DisplayTransport &transport)
+	: Canvas4bpp(width, height, NULL), transport(transport), refreshTerminate(false),
+	  refreshMode(REFRESH_CONTINUOUS), frameCounter(0), skipCounter(0),
+	  emptyFlushCounter(0), framePeriod(0), spinTime(0), lateCounter(0) {
+	init();
 }
 
-OLEDDisplay::OLEDDisplay(coord_t width, coord_t height)
-	: Canvas4bpp(width, height), rst(15), dc(29), spi(0, 0) {
+void OLEDDisplay::init() {
 	refreshEnabled = false;
-	refreshRunning = false;
-	refreshTerminate = false;
-	frameCounter = 0;
-
-	//GPIO Init
-	mraa_dir_retry(rst, mraa::DIR_OUT);
-	mraa_dir_retry(dc, mraa::DIR_OUT);
-	mR(rst.write(0));
-	mR(dc.write(0));
+	sendAll = true;
+	setFrameRate(60);
+	sem_init(&refreshSem, 0, 0);
 
-	// Set SPI clock to 32MHz
-	mR(spi.mode(mraa::SPI_MODE0));
-	mR(spi.frequency(32 * 1000 * 1000));
-	mR(spi.bitPerWord(8));
-	mR(spi.lsbmode(false));
-
-	size_t bufsize = (WIDTH + 1)/2 * HEIGHT;
-	cmdBuf[0].reset(new uint8_t[bufsize]);
-	cmdBuf[1].reset(new uint8_t[bufsize]);
-	std::memset(cmdBuf[0].get(), 0, bufsize);
-	std::memset(cmdBuf[1].get(), 0, bufsize);
-	cmdBufIndex = 0;
-
-	flush();
+	size_t bufsize = Format4bpp::lineLength(WIDTH) * HEIGHT;
+	for (unsigned i = 0; i < BUFFERS; i++) {
+		frameBuf[i].reset(new uint8_t[bufsize]);
+		std::memset(frameBuf[i].get(), 0, bufsize);
+	}
+	// buffer 1 starts out in the mailbox
+	drawIndex = 0;
+	publishedIndex = 1;
+	sendIndex = 2;
+	preserveContents = true;
+	setBuffer(frameBuf[drawIndex].get());
 }
 OLEDDisplay::~OLEDDisplay() {
-	refreshTerminate = true;
-	if (refreshEnabled) {
-		dispThread.join();
-	}
-	rst.write(0);
-	dc.write(0);
+	stopRefresh();
+	sem_destroy(&refreshSem);
+	transport.setReset(false);
+	transport.setDC(false);
 }
 
 void OLEDDisplay::enable() {
 	if (refreshEnabled)
 		return;
 
-	mR(rst.write(0)); //Reset pin low
+	transport.setReset(false); //Reset pin low
 	std::this_thread::sleep_for(std::chrono::milliseconds(100)); //100ms delay
-	mR(rst.write(1)); //Reset pin high
+	transport.setReset(true); //Reset pin high
 	std::this_thread::sleep_for(std::chrono::milliseconds(100)); //100ms delay
 	uint8_t cmd1[] = {
 		0xA4, //set normal display mode
@@ -83,21 +83,20 @@ void OLEDDisplay::enable() {
 		0xA1,
 		0x00, //set display start line to 0
 	};
-	mR(dc.write(0)); //set D/C# pin low
-	mR(spi.transfer(cmd1, NULL, sizeof(cmd1)));
+	transport.writeCommand(cmd1, sizeof(cmd1));
 
 	uint8_t cmd2[] = {
-		0x15,     //set column address
-		0,        //start address
-		WIDTH-1,  //end address
-		0x75,     //set page address
-		0,        //start page
-		HEIGHT-1, //stop page
+		0x15,                //set column address
+		0,                   //start address
+		(uint8_t)(WIDTH-1),  //end address
+		0x75,                //set page address
+		0,                   //start page
+		(uint8_t)(HEIGHT-1), //stop page
 	};
-	mR(dc.write(0)); //set D/C# pin low
-	mR(spi.transfer(cmd2, NULL, sizeof(cmd2)));
+	transport.writeCommand(cmd2, sizeof(cmd2));
 
-	mR(dc.write(1)); //set D/C# pin high
+	// display RAM content is undefined, send the whole first frame
+	sendAll = true;
 
 	// start display thread
 	refreshEnabled = true;
@@ -106,58 +105,188 @@ void OLEDDisplay::enable() {
 }
 
 void OLEDDisplay::disable() {
+	stopRefresh();
+	transport.setReset(false);
+	transport.setDC(false);
+}
+
+void OLEDDisplay::stopRefresh() {
 	refreshTerminate = true;
+	sem_post(&refreshSem);
 	if (refreshEnabled) {
 		dispThread.join();
 		refreshEnabled = false;
 	}
-	mR(rst.write(0));
-	mR(dc.write(0));
 }
 
 void OLEDDisplay::refreshDisplay() {
 	// for good measure, wait a few ms until things have settled
 	std::this_thread::sleep_for(std::chrono::milliseconds(10));
-	std::unique_lock<std::mutex> refreshLock(refreshMutex);
-	refreshRunning = true;
-	refreshCond.notify_all();
 
-	size_t bufsize = (WIDTH + 1)/2 * HEIGHT;
-	uint8_t * const dataPtr[2] = {cmdBuf[0].get(), cmdBuf[1].get()};
+	DamageList all;
+	rect_t r = { 0, 0, WIDTH - 1, HEIGHT - 1 };
+	all.add(r);
+
+	FramePacer pacer;
+	bool paced = false;
 
 	while (!refreshTerminate) {
-		uint8_t index = cmdBufIndex;
-		uint8_t *data = dataPtr[index];
-		cmdBufUsed[index] = true;
-		frameCounter++;
-		refreshLock.unlock();
-		std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
-		//TODO check for error
-		spi.transfer(data, NULL, bufsize);
-		refreshCond.notify_all();
-		std::this_thread::sleep_until(t + std::chrono::microseconds(16666));
-		refreshLock.lock();
+		bool continuous = (refreshMode == REFRESH_CONTINUOUS);
+		if (!continuous && !sendAll) {
+			while (sem_wait(&refreshSem) != 0 && errno == EINTR) {
+				//retry
+			}
+			if (refreshTerminate)
+				break;
+		}
+		std::chrono::nanoseconds period(framePeriod);
+		if (continuous && (!paced || pacer.getPeriod() != period)) {
+			// (re)start the epoch when entering continuous mode
+			pacer.setPeriod(period);
+		}
+		paced = continuous;
+
+		bool fresh = mailbox.take(sendIndex);
+		if (fresh || sendAll) {
+			transmit(frameBuf[sendIndex].get(), sendAll ? all : frameDamage[sendIndex]);
+			sendAll = false;
+			frameCounter++;
+		} else if (continuous) {
+			skipCounter++;
+		}
+		if (continuous) {
+			// wakeups are not needed while polling
+			while (sem_trywait(&refreshSem) == 0) {
+				//drain
+			}
+			pacer.setSpin(std::chrono::nanoseconds(spinTime));
+			if (!pacer.wait())
+				lateCounter++;
+		}
 	}
-	refreshRunning = false;
-	refreshCond.notify_all();
 }
 
+void OLEDDisplay::setWindow(const rect_t &r) {
+	uint8_t cmd[] = {
+		0x15,               //set column address
+		(uint8_t)(r.x0/2),  //start address, 2 pixels per column
+		(uint8_t)(r.x1/2),  //end address
+		0x75,               //set page address
+		(uint8_t)r.y0,      //start page
+		(uint8_t)r.y1,      //stop page
+	};
+	transport.writeCommand(cmd, sizeof(cmd));
+}
+
+// Send the damaged rectangles of the frame in data, each one into its
+// own address window.  Runs on the refresh thread.
+void OLEDDisplay::transmit(const uint8_t *data, const DamageList &damage) {
+	const size_t linelength = Format4bpp::lineLength(WIDTH);
+	const std::vector<rect_t> &rects = damage.getRects();
+	for (size_t i = 0; i < rects.size(); i++) {
+		const rect_t &r = rects[i];
+		setWindow(r);
+
+		size_t c0 = r.x0/2, c1 = r.x1/2;
+		size_t cols = c1 - c0 + 1;
+		const uint8_t *src = data + r.y0 * linelength + c0;
+		size_t len = cols * (r.y1 - r.y0 + 1);
+		if (cols != linelength) {
+			// gather the rows of the window into one transfer
+			txBuf.resize(len);
+			uint8_t *dst = txBuf.data();
+			for (coord_t y = r.y0; y <= r.y1; y++, src += linelength, dst += cols) {
+				std::memcpy(dst, src, cols);
+			}
+			src = txBuf.data();
+		}
+		transport.writeData(src, len);
+	}
+}
+
+// Copy the regions from one framebuffer to another, in whole bytes
+void OLEDDisplay::copyRegions(uint8_t *dst, const uint8_t *src, const DamageList &regions) {
+	const size_t linelength = Format4bpp::lineLength(WIDTH);
+	const std::vector<rect_t> &rects = regions.getRects();
+	for (size_t i = 0; i < rects.size(); i++) {
+		const rect_t &r = rects[i];
+		size_t c0 = r.x0/2, c1 = r.x1/2;
+		size_t offset = r.y0 * linelength + c0;
+		for (coord_t y = r.y0; y <= r.y1; y++, offset += linelength) {
+			std::memcpy(dst + offset, src + offset, c1 - c0 + 1);
+		}
+	}
+}
+
+void OLEDDisplay::setRefreshMode(RefreshMode mode) {
+	refreshMode = mode;
+	sem_post(&refreshSem);
+}
+
+OLEDDisplay::RefreshMode OLEDDisplay::getRefreshMode() {
+	return refreshMode;
+}
 
 uint32_t OLEDDisplay::getFrameCounter() {
-	std::unique_lock<std::mutex> refreshLock(refreshMutex);
-	return this->frameCounter;
+	return frameCounter.load(std::memory_order_relaxed);
+}
+
+uint32_t OLEDDisplay::getSkippedFrames() {
+	return skipCounter.load(std::memory_order_relaxed);
+}
+
+uint32_t OLEDDisplay::getEmptyFlushes() {
+	return emptyFlushCounter.load(std::memory_order_relaxed);
+}
+
+void OLEDDisplay::setFrameRate(double hz) {
+	framePeriod = FramePacer::periodOf(hz).count();
 }
 
+void OLEDDisplay::setSpinTime(std::chrono::nanoseconds spin) {
+	spinTime = spin.count();
+}
+
+uint32_t OLEDDisplay::getLateFrames() {
+	return lateCounter.load(std::memory_order_relaxed);
+}
+
+void OLEDDisplay::setPreserveContents(bool preserve) {
+	preserveContents = preserve;
+}
+
+// Publish the buffer the canvas has drawn into and rebind the canvas to
+// the buffer handed back by the mailbox.
 void OLEDDisplay::flush() {
-	size_t bufsize = (WIDTH + 1)/2 * HEIGHT;
-	uint8_t freeIndex = 1 - cmdBufIndex;
-	uint8_t *dst = cmdBuf[freeIndex].get();
-	uint8_t *src = this->getBuffer();
-	std::memcpy(dst, src, bufsize);
-	std::unique_lock<std::mutex> refreshLock(refreshMutex);
-	cmdBufIndex = freeIndex;
-	cmdBufUsed[freeIndex] = false;
-	while (!cmdBufUsed[freeIndex] && refreshRunning) {
-		refreshCond.wait(refreshLock);
+	if (getDamage().empty()) {
+		// unchanged frame, nothing to publish
+		emptyFlushCounter++;
+		return;
+	}
+
+	const DamageList &damage = getDamage();
+	for (unsigned i = 0; i < BUFFERS; i++) {
+		if (i != drawIndex)
+			stale[i].add(damage);
 	}
+	// a frame replaced in the mailbox is never sent, so each frame carries
+	// the damage of all frames since the last one taken
+	unsent.add(damage);
+	frameDamage[drawIndex] = unsent;
+	publishedIndex = drawIndex;
+
+	bool dropped;
+	unsigned next = mailbox.publish(drawIndex, dropped);
+	sem_post(&refreshSem);
+	if (!dropped) {
+		unsent.clear();
+		unsent.add(damage);
+	}
+
+	drawIndex = next;
+	if (preserveContents)
+		copyRegions(frameBuf[next].get(), frameBuf[publishedIndex].get(), stale[next]);
+	stale[next].clear();
+	setBuffer(frameBuf[next].get());
+	clearDamage();
 }
@@ -1,53 +1,153 @@
 #ifndef OLEDDISPLAY_H_
 #define OLEDDISPLAY_H_
 
-#include <mutex>
+#include <atomic>
+#include <memory>
 #include <thread>
-#include <condition_variable>
+#include <vector>
 
-#include <mraa/gpio.hpp>
-#include <mraa/pwm.hpp>
-#include <mraa/spi.hpp>
+#include <semaphore.h>
 
 #include "Canvas.h"
+#include "DisplayTransport.h"
+#include "FramePacer.h"
+#include "TripleBuffer.h"
 
 namespace GFX {
 
 class OLEDDisplay : public Canvas4bpp{
+public:
+	enum RefreshMode {
+		/**
+		 * Refresh thread wakes up at a fixed rate (see setFrameRate())
+		 * and sends whatever changed since the last tick.
+		 */
+		REFRESH_CONTINUOUS,
+		/**
+		 * Refresh thread sleeps until flush() publishes a changed frame
+		 * and sends it exactly once.
+		 */
+		REFRESH_ON_DEMAND,
+	};
+
 private:
-	mraa::Gpio rst; // Reset
-	mraa::Gpio dc; // Data/Command
-	mraa::Spi spi;
+	std::unique_ptr<DisplayTransport> ownTransport;
+	DisplayTransport &transport;
+
+	static const unsigned BUFFERS = 3;
 
 	/**
-	 * 2 additional Framebuffers
+	 * Framebuffers, the canvas draws into frameBuf[drawIndex]
+	 */
+	std::unique_ptr<uint8_t[]> frameBuf[BUFFERS];
+	/**
+	 * Regions changed in each buffer since the last frame the refresh
+	 * thread has sent, handed over together with the buffer
 	 */
-	std::unique_ptr<uint8_t[]> cmdBuf[2];
+	DamageList frameDamage[BUFFERS];
+	/**
+	 * Passes framebuffers from flush() to the refresh thread
+	 */
+	TripleBuffer mailbox;
 
-	std::mutex refreshMutex;
-	std::thread dispThread;
-	std::condition_variable refreshCond;
+	// render thread side
+	// buffer the canvas draws into
+	unsigned drawIndex;
+	// most recently published buffer
+	unsigned publishedIndex;
+	/**
+	 * Regions published since each buffer was last drawn into
+	 */
+	DamageList stale[BUFFERS];
+	/**
+	 * Regions of the published frames that may not have been sent yet
+	 */
+	DamageList unsent;
+	bool preserveContents;
 	// thread has been started and has not been joined
 	bool refreshEnabled;
-	// thread is running
-	bool refreshRunning;
-	// thread should terminate
-	bool refreshTerminate;
-	// count frames to compute fps
-	uint32_t frameCounter;
-	uint8_t cmdBufIndex;
-	bool cmdBufUsed[2];
 
+	// refresh thread side
+	// buffer being transmitted
+	unsigned sendIndex;
+	// next frame is sent completely
+	bool sendAll;
+
+	std::thread dispThread;
+	// posted whenever the refresh thread should look at the mailbox
+	sem_t refreshSem;
+	std::atomic<bool> refreshTerminate;
+	std::atomic<RefreshMode> refreshMode;
+	// count transmitted frames to compute fps
+	std::atomic<uint32_t> frameCounter;
+	// count ticks of the continuous mode without a new frame to send
+	std::atomic<uint32_t> skipCounter;
+	// count flush() calls without damage, which publish nothing
+	std::atomic<uint32_t> emptyFlushCounter;
+	// pacing of the continuous mode, in ns
+	std::atomic<int64_t> framePeriod;
+	std::atomic<int64_t> spinTime;
+	// count ticks of the continuous mode that missed their deadline
+	std::atomic<uint32_t> lateCounter;
+	/**
+	 * Scratch buffer to gather the rows of a partial update
+	 */
+	std::vector<uint8_t> txBuf;
+
+	void init();
 	void refreshDisplay();
+	void stopRefresh();
+	void setWindow(const rect_t &r);
+	void transmit(const uint8_t *data, const DamageList &damage);
+	void copyRegions(uint8_t *dst, const uint8_t *src, const DamageList &regions);
 
 public:
+	/**
+	 * Display on the default pins through libmraa, or on a
+	 * HeadlessTransport if the library is built without libmraa.
+	 */
 	OLEDDisplay(int width, int height);
+	/**
+	 * Display on the given transport, which must outlive the display.
+	 */
+	OLEDDisplay(int width, int height, DisplayTransport &transport);
 	virtual ~OLEDDisplay();
 
 	void enable();
 	void disable();
 
+	void setRefreshMode(RefreshMode mode);
+	RefreshMode getRefreshMode();
+
 	uint32_t getFrameCounter();
+	/**
+	 * Ticks of the continuous refresh mode that sent nothing because no
+	 * new frame was published, comparable to getFrameCounter()
+	 */
+	uint32_t getSkippedFrames();
+	/**
+	 * Calls to flush() that published nothing because nothing was drawn
+	 */
+	uint32_t getEmptyFlushes();
+
+	/**
+	 * Tick rate of the continuous refresh mode, 60 Hz by default.
+	 * Throws std::invalid_argument unless hz is positive and finite.
+	 */
+	void setFrameRate(double hz);
+	/**
+	 * Busy-wait for the last part of each tick for more precise pacing
+	 */
+	void setSpinTime(std::chrono::nanoseconds spin);
+	uint32_t getLateFrames();
+
+	/**
+	 * If set (default), flush() brings the buffer the canvas is rebound
+	 * to up to date, so drawing continues on top of the last frame.
+	 * Clear it if every frame is redrawn from scratch; the contents of
+	 * the canvas are undefined after flush() then.
+	 */
+	void setPreserveContents(bool preserve);
 
 	virtual void flush();
 };
@@ -0,0 +1,280 @@
+#ifndef _PIXELFORMAT_H_
+#define _PIXELFORMAT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace GFX {
+
+typedef int32_t coord_t;
+typedef uint32_t color_t;
+
+// Horizontal run of pixels in device coordinates, x0 <= x1, both inclusive
+struct span_t {
+	coord_t y;
+	coord_t x0;
+	coord_t x1;
+};
+
+// Run of equal pixels in row y of a glyph bitmap, x0 <= x1, both
+// inclusive.  level is the coverage of anti-aliased bitmaps, 0 to
+// 2^bpp - 1, and 0 or 1 for 1-bit bitmaps.
+struct run_t {
+	coord_t y;
+	coord_t x0;
+	coord_t x1;
+	uint8_t level;
+};
+
+// Rectangle in device coordinates, x0 <= x1 and y0 <= y1, all inclusive
+struct rect_t {
+	coord_t x0;
+	coord_t y0;
+	coord_t x1;
+	coord_t y1;
+};
+
+// Pixel format traits used to instantiate CanvasT.  Each format describes
+// how pixels are packed into the storage unit 'unit_t' and provides the
+// inline pixel store used by all primitives:
+//   lineLength(w)          storage units per scanline
+//   translate(c)           0xRRGGBB to the native pixel value
+//   get(line, x)           load a single native pixel
+//   put(line, x, c)        store a single native pixel
+//   fill(line, x0, x1, c)  store a run of pixels, x0 <= x1, both inclusive
+//   column(line, pitch, x, n, c)
+//                          store pixel x of n lines, 'pitch' units apart
+//   mix(d, s, a, max)      native pixel a/max of the way from d to s
+// Coordinates passed to get(), put() and fill() are already clipped.
+
+// 1 bit per pixel, MSB is the leftmost pixel of a byte
+struct Format1bpp {
+	typedef uint8_t unit_t;
+	static const unsigned BITS = 1;
+
+	static size_t lineLength(coord_t w) {
+		return (w + 7) / 8;
+	}
+	static color_t translate(color_t color) {
+		color_t x = (color & 0xFF) + ((color >> 8) & 0xFF) + ((color >> 16) & 0xFF);
+		return x < 3 * 128 ? 0 : 1;
+	}
+	static uint8_t mask(coord_t x) {
+		return 0x80 >> (x & 7);
+	}
+	static color_t get(const unit_t *line, coord_t x) {
+		return (line[x / 8] & mask(x)) != 0;
+	}
+	static void put(unit_t *line, coord_t x, color_t color) {
+		uint8_t *ptr = line + (x / 8);
+		uint8_t m = mask(x);
+		*ptr = (*ptr & ~m) | (-(color & 1) & m);
+	}
+	// partial bytes at both ends are masked, whole bytes in between set
+	// with memset
+	static void fill(unit_t *line, coord_t x0, coord_t x1, color_t color) {
+		uint8_t *ptr0 = line + (x0 >> 3);
+		uint8_t *ptr1 = line + (x1 >> 3);
+		uint8_t mask0 = 0xFF >> (x0 & 7);
+		uint8_t mask1 = 0xFF << (7 - (x1 & 7));
+		uint8_t v = -(color & 1);
+
+		if (ptr0 == ptr1) {
+			uint8_t m = mask0 & mask1;
+			*ptr0 = (*ptr0 & ~m) | (v & m);
+		} else {
+			*ptr0 = (*ptr0 & ~mask0) | (v & mask0);
+			memset(ptr0 + 1, v, ptr1 - ptr0 - 1);
+			*ptr1 = (*ptr1 & ~mask1) | (v & mask1);
+		}
+	}
+	// the same bit of every line's byte
+	static void column(unit_t *line, size_t pitch, coord_t x, coord_t n, color_t color) {
+		uint8_t *ptr = line + (x >> 3);
+		uint8_t m = mask(x);
+		if (color & 1) {
+			for (coord_t i = 0; i < n; i++, ptr += pitch)
+				*ptr |= m;
+		} else {
+			for (coord_t i = 0; i < n; i++, ptr += pitch)
+				*ptr &= ~m;
+		}
+	}
+	// no intermediate levels, the nearer color wins
+	static color_t mix(color_t dst, color_t src, unsigned a, unsigned max) {
+		return 2 * a >= max ? src : dst;
+	}
+};
+
+// 4 bits per pixel, high nibble is the leftmost pixel of a byte
+struct Format4bpp {
+	typedef uint8_t unit_t;
+	static const unsigned BITS = 4;
+
+	static size_t lineLength(coord_t w) {
+		return (w + 1) / 2;
+	}
+	static color_t translate(color_t color) {
+		color_t x = (color & 0xFF) + ((color >> 8) & 0xFF) + ((color >> 16) & 0xFF);
+		return x / 3;
+	}
+	// pixel value replicated into both nibbles
+	static uint8_t pack(color_t color) {
+		return (color & 0xF) | ((color & 0xF) << 4);
+	}
+	static color_t get(const unit_t *line, coord_t x) {
+		return (line[x / 2] >> ((~x & 1) << 2)) & 0xF;
+	}
+	static void put(unit_t *line, coord_t x, color_t color) {
+		uint8_t *ptr = line + (x / 2);
+		uint8_t shift = (x & 1) << 2;
+		*ptr = (*ptr & (0xF0F >> shift)) | ((color & 0xF) << (4 - shift));
+	}
+	static void fill(unit_t *line, coord_t x0, coord_t x1, color_t color) {
+		uint8_t shift0 = (x0 & 1) << 2;
+		uint8_t shift1 = (x1 & 1) << 2;
+		uint8_t amask0 = (0xF00 >> shift0);
+		uint8_t amask1 = (0x00F >> shift1);
+		uint8_t omask = pack(color);
+
+		uint8_t *ptr0 = line + (x0 / 2);
+		uint8_t *ptr1 = line + (x1 / 2);
+
+		if (ptr0 == ptr1) {
+			uint8_t amask = amask0 | amask1;
+			*ptr0 = (*ptr0 & amask) | (omask & ~amask);
+		} else {
+			*ptr0 = (*ptr0 & amask0) | (omask & ~amask0);
+			for (ptr0++; ptr0 < ptr1; ptr0++) {
+				*ptr0 = omask;
+			}
+			*ptr1 = (*ptr1 & amask1) | (omask & ~amask1);
+		}
+	}
+	static void column(unit_t *line, size_t pitch, coord_t x, coord_t n, color_t color) {
+		uint8_t *ptr = line + (x / 2);
+		uint8_t shift = (x & 1) << 2;
+		uint8_t amask = 0xF0F >> shift, omask = (color & 0xF) << (4 - shift);
+		for (coord_t i = 0; i < n; i++, ptr += pitch)
+			*ptr = (*ptr & amask) | omask;
+	}
+	static color_t mix(color_t dst, color_t src, unsigned a, unsigned max) {
+		return ((dst & 0xF) * (max - a) + (src & 0xF) * a + max / 2) / max;
+	}
+};
+
+// 8 bits per pixel (grayscale)
+struct Format8bpp {
+	typedef uint8_t unit_t;
+	static const unsigned BITS = 8;
+
+	static size_t lineLength(coord_t w) {
+		return w;
+	}
+	static color_t translate(color_t color) {
+		color_t x = (color & 0xFF) + ((color >> 8) & 0xFF) + ((color >> 16) & 0xFF);
+		return x / 3;
+	}
+	static color_t get(const unit_t *line, coord_t x) {
+		return line[x];
+	}
+	static void put(unit_t *line, coord_t x, color_t color) {
+		line[x] = color;
+	}
+	static void fill(unit_t *line, coord_t x0, coord_t x1, color_t color) {
+		memset(line + x0, color, x1 - x0 + 1);
+	}
+	static void column(unit_t *line, size_t pitch, coord_t x, coord_t n, color_t color) {
+		for (coord_t i = 0; i < n; i++, line += pitch)
+			line[x] = color;
+	}
+	static color_t mix(color_t dst, color_t src, unsigned a, unsigned max) {
+		return (dst * (max - a) + src * a + max / 2) / max;
+	}
+};
+
+// 16 bits per pixel (RGB 5/6/5)
+struct Format16bpp {
+	typedef uint16_t unit_t;
+	static const unsigned BITS = 16;
+
+	static size_t lineLength(coord_t w) {
+		return w;
+	}
+	static color_t translate(color_t color) {
+		return ((color & 0xF8) >> 3)
+				| ((color & 0xFC00) >> 5)
+				| ((color & 0xF80000) >> 8);
+	}
+	static color_t get(const unit_t *line, coord_t x) {
+		return line[x];
+	}
+	static void put(unit_t *line, coord_t x, color_t color) {
+		line[x] = color;
+	}
+	// colors with equal bytes (black, white) are set with memset, others
+	// with aligned 16-byte stores of 8 pixels, two per iteration, where
+	// SSE2 or NEON is available.  The unaligned ends and the rest are
+	// stored pixel by pixel.
+	static void fill(unit_t *line, coord_t x0, coord_t x1, color_t color) {
+		uint16_t *ptr = line + x0, *end = line + x1 + 1;
+		uint16_t v = color;
+		if ((v >> 8) == (v & 0xFF)) {
+			memset(ptr, v & 0xFF, (end - ptr) * sizeof(uint16_t));
+			return;
+		}
+#if defined(__SSE2__) || defined(__ARM_NEON)
+		for (; ptr < end && ((uintptr_t) ptr & 15); ptr++)
+			*ptr = v;
+#if defined(__SSE2__)
+		__m128i v8 = _mm_set1_epi16(v);
+		for (; end - ptr >= 16; ptr += 16) {
+			_mm_store_si128((__m128i *) ptr, v8);
+			_mm_store_si128((__m128i *) (ptr + 8), v8);
+		}
+		if (end - ptr >= 8) {
+			_mm_store_si128((__m128i *) ptr, v8);
+			ptr += 8;
+		}
+#else
+		uint16x8_t v8 = vdupq_n_u16(v);
+		for (; end - ptr >= 16; ptr += 16) {
+			vst1q_u16(ptr, v8);
+			vst1q_u16(ptr + 8, v8);
+		}
+		if (end - ptr >= 8) {
+			vst1q_u16(ptr, v8);
+			ptr += 8;
+		}
+#endif
+#endif
+		for (; ptr < end; ptr++)
+			*ptr = v;
+	}
+	static void column(unit_t *line, size_t pitch, coord_t x, coord_t n, color_t color) {
+		for (coord_t i = 0; i < n; i++, line += pitch)
+			line[x] = color;
+	}
+	// channel of a 5/6/5 pixel, shift and width of the field
+	static color_t mixField(color_t dst, color_t src, unsigned a, unsigned max,
+			unsigned shift, color_t m) {
+		color_t d = (dst >> shift) & m, s = (src >> shift) & m;
+		return ((d * (max - a) + s * a + max / 2) / max) << shift;
+	}
+	static color_t mix(color_t dst, color_t src, unsigned a, unsigned max) {
+		return mixField(dst, src, a, max, 11, 0x1F)
+				| mixField(dst, src, a, max, 5, 0x3F)
+				| mixField(dst, src, a, max, 0, 0x1F);
+	}
+};
+
+}
+
+#endif // _PIXELFORMAT_H_
@@ -0,0 +1,54 @@
+#include "PreparedFont.h"
+
+#include <algorithm>
+
+using namespace GFX;
+
+PreparedFont::PreparedFont(const GFXfont *font) : font(font), font2(NULL), repacked(true) {
+	repackGlyphs(font->bitmap, font->glyph, font->last - font->first + 1);
+}
+
+PreparedFont::PreparedFont(const GFXfont2 &font) : font(NULL), font2(&font), repacked(font.bpp <= 1) {
+	if (repacked) {
+		repackGlyphs(font.bitmap, font.glyph, font.glyphCount);
+		return;
+	}
+	for (size_t i = 0; i < font.glyphCount; i++) {
+		bitmaps.push_back(font.bitmap + font.glyph[i].bitmapOffset);
+	}
+}
+
+template<class G>
+void PreparedFont::repackGlyphs(const uint8_t *bitmap, const G *glyphs, size_t n) {
+	size_t size = 0;
+	for (size_t i = 0; i < n; i++) {
+		size += stride(glyphs[i].width) / 8 * glyphs[i].height;
+	}
+	data.reserve(size);
+	std::vector<size_t> offsets(n);
+	for (size_t i = 0; i < n; i++) {
+		offsets[i] = data.size();
+		repack(bitmap + glyphs[i].bitmapOffset, glyphs[i].width, glyphs[i].height);
+	}
+	for (size_t i = 0; i < n; i++) {
+		bitmaps.push_back(data.data() + offsets[i]);
+	}
+}
+
+// Append the bit-packed bitmap with rows padded to stride(w) bits, a
+// byte at a time
+void PreparedFont::repack(const uint8_t *bits, coord_t w, coord_t h) {
+	size_t pitch = stride(w) / 8, bit = 0;
+	for (coord_t j = 0; j < h; j++, bit += w) {
+		size_t row = data.size();
+		data.resize(row + pitch);
+		for (coord_t i = 0; i < w; i += 8) {
+			size_t b = bit + i;
+			unsigned shift = b & 7, n = std::min<coord_t>(8, w - i);
+			unsigned v = bits[b >> 3] << shift;
+			if (shift + n > 8) // never reads past the glyph
+				v |= bits[(b >> 3) + 1] >> (8 - shift);
+			data[row + i / 8] = v & (0xFF00 >> n);
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef _PREPAREDFONT_H_
+#define _PREPAREDFONT_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "PixelFormat.h"
+#include "gfxfont.h"
+
+namespace GFX {
+
+// Glyph bitmaps of a font repacked with every row padded to a whole 8,
+// 16, 32 or 64-bit word (the smallest the glyph fits in, several 64-bit
+// words for wider glyphs), so rows are scanned a word at a time (see
+// prim::scanRuns()) instead of a bit at a time.  Canvas::setFont()
+// prepares the fonts it is given itself, a PreparedFont passed to
+// setFont() in a shared_ptr is shared by any number of canvases.
+// Anti-aliased glyphs are kept as they are.
+class PreparedFont {
+public:
+	explicit PreparedFont(const GFXfont *font);
+	explicit PreparedFont(const GFXfont2 &font);
+
+	const GFXfont *getFont() const {
+		return font;
+	}
+	const GFXfont2 *getFont2() const {
+		return font2;
+	}
+	// Bitmap of glyph number i
+	const uint8_t *getBitmap(size_t i) const {
+		return bitmaps[i];
+	}
+	// Distance in pixels between the rows of glyph number i, w pixels wide
+	size_t getStride(coord_t w) const {
+		return repacked ? stride(w) : w;
+	}
+	// Bytes of the repacked bitmaps
+	size_t getSize() const {
+		return data.size();
+	}
+
+	// Row pitch in bits of a repacked glyph w pixels wide
+	static size_t stride(coord_t w) {
+		return w <= 8 ? 8 : w <= 16 ? 16 : w <= 32 ? 32 : (w + 63) & ~63;
+	}
+
+private:
+	template<class G>
+	void repackGlyphs(const uint8_t *bitmap, const G *glyphs, size_t n);
+	void repack(const uint8_t *bits, coord_t w, coord_t h);
+
+	const GFXfont *font;
+	const GFXfont2 *font2;
+	bool repacked;
+	std::vector<uint8_t> data;
+	std::vector<const uint8_t *> bitmaps;
+};
+
+}
+
+#endif // _PREPAREDFONT_H_
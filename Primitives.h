@@ -0,0 +1,481 @@
+#ifndef _PRIMITIVES_H_
+#define _PRIMITIVES_H_
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "PixelFormat.h"
+
+namespace GFX {
+
+// Drawing algorithms shared by Canvas and CanvasT.  All coordinates are
+// device (unrotated) coordinates and all colors are already translated.
+// The algorithms are written against a 'sink' which must provide
+//   void pixel(coord_t x, coord_t y, color_t color);
+//   void hline(coord_t x0, coord_t y, coord_t x1, color_t color);
+//   void vline(coord_t x, coord_t y0, coord_t y1, color_t color);
+//   void rect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color);
+//   void spans(const span_t *spans, size_t n, color_t color);
+// Canvas passes a sink that dispatches through the virtual core draw API,
+// CanvasT passes one that inlines the pixel store of its format.
+namespace prim {
+
+template<class T>
+inline void swap(T &a, T &b) {
+	T t = a;
+	a = b;
+	b = t;
+}
+
+template<class T>
+inline void sort(T &a, T &b) {
+	if (a > b)
+		swap(a, b);
+}
+
+// Collects the scanlines of a filled primitive in a small stack buffer
+// and submits them to the sink in batches of N spans.
+template<class S, size_t N = 32>
+class SpanBatch {
+private:
+	S &s;
+	color_t color;
+	size_t n;
+	span_t buf[N];
+public:
+	SpanBatch(S &s) : s(s), color(0), n(0) {
+		//nothing
+	}
+	~SpanBatch() {
+		flush();
+	}
+	void hline(coord_t x0, coord_t y, coord_t x1, color_t c) {
+		if (n == N || (n > 0 && c != color))
+			flush();
+		color = c;
+		span_t &sp = buf[n++];
+		sp.y = y;
+		sp.x0 = x0;
+		sp.x1 = x1;
+	}
+	void rect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t c) {
+		for (coord_t y = y0; y <= y1; y++) {
+			hline(x0, y, x1, c);
+		}
+	}
+	void flush() {
+		if (n > 0)
+			s.spans(buf, n, color);
+		n = 0;
+	}
+};
+
+// Bresenham's algorithm - thx wikpedia
+template<class S>
+void line(S &s, coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t color) {
+	bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
+	if (steep) {
+		swap(x0, y0);
+		swap(x1, y1);
+	}
+
+	if (x0 > x1) {
+		swap(x0, x1);
+		swap(y0, y1);
+	}
+
+	coord_t dx, dy;
+	dx = x1 - x0;
+	dy = std::abs(y1 - y0);
+
+	coord_t err = dx / 2;
+	coord_t ystep;
+
+	if (y0 < y1) {
+		ystep = 1;
+	} else {
+		ystep = -1;
+	}
+
+	for (; x0 <= x1; x0++) {
+		if (steep) {
+			s.pixel(y0, x0, color);
+		} else {
+			s.pixel(x0, y0, color);
+		}
+		err -= dy;
+		if (err < 0) {
+			y0 += ystep;
+			err += dx;
+		}
+	}
+}
+
+// Circle outline; deltaX/deltaY stretch the right/bottom half for round rects
+template<class S>
+void circle(S &s, coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY, color_t color) {
+	coord_t f = 1 - r;
+	coord_t ddF_x = 1;
+	coord_t ddF_y = -2 * r;
+	coord_t x = 0;
+	coord_t y = r;
+
+	s.pixel(x0 + y + deltaX, y0 + x + deltaY, color);
+	s.pixel(x0 + x + deltaX, y0 - y, color);
+	s.pixel(x0 - x, y0 + y + deltaY, color);
+	s.pixel(x0 - y, y0 - x, color);
+
+	while (x < y) {
+		if (f >= 0) {
+			y--;
+			ddF_y += 2;
+			f += ddF_y;
+		}
+		x++;
+		ddF_x += 2;
+		f += ddF_x;
+		s.pixel(x0 + x + deltaX, y0 + y + deltaY, color);
+		s.pixel(x0 + y + deltaX, y0 + x + deltaY, color);
+		s.pixel(x0 + x + deltaX, y0 - y, color);
+		s.pixel(x0 + y + deltaX, y0 - x, color);
+		s.pixel(x0 - x, y0 + y + deltaY, color);
+		s.pixel(x0 - y, y0 + x + deltaY, color);
+		s.pixel(x0 - x, y0 - y, color);
+		s.pixel(x0 - y, y0 - x, color);
+	}
+}
+
+// Filled circle without the center line; used to do circles and roundrects
+template<class S>
+void fillCircle(S &s, coord_t x0, coord_t y0, coord_t r, coord_t deltaX, coord_t deltaY, color_t color) {
+	coord_t f = 1 - r;
+	coord_t ddF_x = 1;
+	coord_t ddF_y = -2 * r;
+	coord_t x = 0;
+	coord_t y = r;
+	SpanBatch<S> batch(s);
+
+	while (x < y) {
+		if (f >= 0) {
+			y--;
+			ddF_y += 2;
+			f += ddF_y;
+		}
+		x++;
+		ddF_x += 2;
+		f += ddF_x;
+
+		batch.hline(x0 - x, y0 + y + deltaY, x0 + x + deltaX, color);
+		batch.hline(x0 - y, y0 + x + deltaY, x0 + y + deltaX, color);
+		batch.hline(x0 - x, y0 - y, x0 + x + deltaX, color);
+		batch.hline(x0 - y, y0 - x, x0 + y + deltaX, color);
+	}
+}
+
+template<class S>
+void fillTriangle(S &s, coord_t x0, coord_t y0, coord_t x1, coord_t y1, coord_t x2, coord_t y2, color_t color) {
+	// Sort coordinates by Y order (y2 >= y1 >= y0)
+	if (y0 > y1) {
+		swap(y0, y1); swap(x0, x1);
+	}
+	if (y1 > y2) {
+		swap(y2, y1); swap(x2, x1);
+	}
+	if (y0 > y1) {
+		swap(y0, y1); swap(x0, x1);
+	}
+
+	if (y0 == y2) { // Handle awkward all-on-same-line case as its own thing
+		coord_t a = x0;
+		coord_t b = x0;
+		if (x1 < a)
+			a = x1;
+		else if (x1 > b)
+			b = x1;
+		if (x2 < a)
+			a = x2;
+		else if (x2 > b)
+			b = x2;
+		s.hline(a, y0, b, color);
+		return;
+	}
+
+	coord_t dx01 = x1 - x0;
+	coord_t dy01 = y1 - y0;
+	coord_t dx02 = x2 - x0;
+	coord_t dy02 = y2 - y0;
+	coord_t dx12 = x2 - x1;
+	coord_t dy12 = y2 - y1;
+	// dx * dy overflows 32 bits beyond 46340 pixels
+	int64_t sa   = 0;
+	int64_t sb   = 0;
+
+	// For upper part of triangle, find scanline crossings for segments
+	// 0-1 and 0-2.  If y1=y2 (flat-bottomed triangle), the scanline y1
+	// is included here (and second loop will be skipped, avoiding a /0
+	// error there), otherwise scanline y1 is skipped here and handled
+	// in the second loop...which also avoids a /0 error here if y0=y1
+	// (flat-topped triangle).
+	coord_t last;
+	if (y1 == y2)
+		last = y1;   // Include y1 scanline
+	else
+		last = y1-1; // Skip it
+
+	SpanBatch<S> batch(s);
+	coord_t y = y0;
+	for (; y <= last; y++) {
+		coord_t a = x0 + sa / dy01;
+		coord_t b = x0 + sb / dy02;
+		sa += dx01;
+		sb += dx02;
+		/* longhand:
+		a = x0 + (x1 - x0) * (y - y0) / (y1 - y0);
+		b = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
+		*/
+		sort(a, b);
+		batch.hline(a, y, b, color);
+	}
+
+	// For lower part of triangle, find scanline crossings for segments
+	// 0-2 and 1-2.  This loop is skipped if y1=y2.
+	sa = (int64_t) dx12 * (y - y1);
+	sb = (int64_t) dx02 * (y - y0);
+	for (; y <= y2; y++) {
+		coord_t a = x1 + sa / dy12;
+		coord_t b = x0 + sb / dy02;
+		sa += dx12;
+		sb += dx02;
+		/* longhand:
+		a = x1 + (x2 - x1) * (y - y1) / (y2 - y1);
+		b = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
+		*/
+		sort(a, b);
+		batch.hline(a, y, b, color);
+	}
+}
+
+// Number of leading zero bits of v, 64 for 0
+inline unsigned leadingZeros(uint64_t v) {
+#ifdef __GNUC__
+	return v ? __builtin_clzll(v) : 64;
+#else
+	unsigned n = 0;
+	for (; n < 64 && !(v >> 63); n++)
+		v <<= 1;
+	return n;
+#endif
+}
+
+// B bits (8, 16, 32 or 64) at p, MSB first, in the high bits of the result
+template<unsigned B>
+inline uint64_t loadBits(const uint8_t *p) {
+	uint64_t v = 0;
+	for (unsigned i = 0; i < B / 8; i++)
+		v = (v << 8) | p[i];
+	return B == 64 ? v : v << (64 - B);
+}
+
+// scanRuns() of rows starting at multiples of B bits.  Rows are read a
+// word at a time, the length of every run within a word is a count of
+// leading zeros (of the word or its complement) instead of a bit loop.
+template<unsigned B, class E>
+void scanWords(const uint8_t *bits, size_t stride, coord_t w, coord_t h, E &emit) {
+	for (coord_t j = 0; j < h; j++) {
+		const uint8_t *row = bits + (size_t) j * (stride / 8);
+		bool cur = row[0] & 0x80;
+		coord_t start = 0, x = 0;
+		for (; x < w; row += B / 8) {
+			uint64_t v = loadBits<B>(row);
+			coord_t end = std::min<coord_t>(x + B, w);
+			while (x < end) {
+				bool b = v >> 63;
+				unsigned n = leadingZeros(b ? ~v : v);
+				if (b != cur) {
+					emit(j, start, x - 1, cur);
+					start = x;
+					cur = b;
+				}
+				x = std::min<coord_t>(x + n, end);
+				v = n < 64 ? v << n : 0;
+			}
+		}
+		emit(j, start, w - 1, cur);
+	}
+}
+
+// Calls emit(y, x0, x1, level) for every run of equal bits in the rows of
+// a 1-bit bitmap, MSB first, consecutive rows start 'stride' bits apart
+// (stride == w for packed GFXfont glyphs, (w + 7) & ~7 for byte padded
+// bitmaps).  Rows padded to whole bytes are scanned a word at a time, the
+// widest word stride is a multiple of (see PreparedFont).
+template<class E>
+void scanRuns(const uint8_t *bits, size_t stride, coord_t w, coord_t h, E &emit) {
+	if (w <= 0)
+		return;
+	if (stride % 64 == 0)
+		return scanWords<64>(bits, stride, w, h, emit);
+	if (stride % 32 == 0)
+		return scanWords<32>(bits, stride, w, h, emit);
+	if (stride % 16 == 0)
+		return scanWords<16>(bits, stride, w, h, emit);
+	if (stride % 8 == 0)
+		return scanWords<8>(bits, stride, w, h, emit);
+	size_t row = 0;
+	for (coord_t j = 0; j < h; j++, row += stride) {
+		size_t bit = row;
+		bool cur = bits[bit >> 3] & (0x80 >> (bit & 7));
+		coord_t start = 0;
+		for (coord_t i = 1; i < w; i++) {
+			bit++;
+			bool b = bits[bit >> 3] & (0x80 >> (bit & 7));
+			if (b != cur) {
+				emit(j, start, i - 1, cur);
+				start = i;
+				cur = b;
+			}
+		}
+		emit(j, start, w - 1, cur);
+	}
+}
+
+// Calls emit(y, x0, x1, level) for every run of equal coverage in the
+// rows of an anti-aliased bitmap of bpp (2 or 4) bits per pixel, MSB
+// first, consecutive rows start 'stride' pixels apart.
+template<class E>
+void scanLevels(const uint8_t *bits, size_t stride, unsigned bpp, coord_t w, coord_t h, E &emit) {
+	if (w <= 0)
+		return;
+	const unsigned mask = (1 << bpp) - 1;
+	size_t row = 0;
+	for (coord_t j = 0; j < h; j++, row += stride * bpp) {
+		size_t bit = row;
+		unsigned cur = (bits[bit >> 3] >> (8 - bpp - (bit & 7))) & mask;
+		coord_t start = 0;
+		for (coord_t i = 1; i < w; i++) {
+			bit += bpp;
+			unsigned l = (bits[bit >> 3] >> (8 - bpp - (bit & 7))) & mask;
+			if (l != cur) {
+				emit(j, start, i - 1, cur);
+				start = i;
+				cur = l;
+			}
+		}
+		emit(j, start, w - 1, cur);
+	}
+}
+
+// Device rectangle of pixels i0..i1 of row j of a bitmap.  (x,y) is the
+// device position of the logical top-left corner, mrot the rotation
+// matrix of the canvas.  Every source pixel covers size x size device
+// pixels, so a run becomes one rectangle.
+inline void runRect(coord_t x, coord_t y, const int8_t *mrot, coord_t size,
+		coord_t j, coord_t i0, coord_t i1, rect_t &r) {
+	coord_t lx0 = i0 * size, lx1 = (i1 + 1) * size - 1;
+	coord_t ly0 = j * size, ly1 = (j + 1) * size - 1;
+	r.x0 = x + mrot[0] * lx0 + mrot[1] * ly0;
+	r.y0 = y + mrot[2] * lx0 + mrot[3] * ly0;
+	r.x1 = x + mrot[0] * lx1 + mrot[1] * ly1;
+	r.y1 = y + mrot[2] * lx1 + mrot[3] * ly1;
+	sort(r.x0, r.x1);
+	sort(r.y0, r.y1);
+}
+
+// Draws runs of a bitmap, see runRect().  Unset runs are drawn in bg if
+// opaque.
+template<class S>
+struct RunDrawer {
+	S &s;
+	coord_t x, y;
+	const int8_t *mrot;
+	coord_t size;
+	color_t fg, bg;
+	bool opaque;
+
+	void operator()(coord_t j, coord_t i0, coord_t i1, bool set) {
+		if (!set && !opaque)
+			return;
+		rect_t r;
+		runRect(x, y, mrot, size, j, i0, i1, r);
+		s.rect(r.x0, r.y0, r.x1, r.y1, set ? fg : bg);
+	}
+};
+
+// Partial coverage level of transparent text, drawn in the ramp color
+// without blending
+template<bool BLEND>
+struct PartialLevel {
+	template<class S>
+	static void draw(S &s, const rect_t &r, unsigned, color_t color) {
+		s.rect(r.x0, r.y0, r.x1, r.y1, color);
+	}
+};
+
+template<>
+struct PartialLevel<true> {
+	template<class S>
+	static void draw(S &s, const rect_t &r, unsigned level, color_t) {
+		s.blend(r.x0, r.y0, r.x1, r.y1, level);
+	}
+};
+
+// Draws runs of an anti-aliased bitmap in the color ramp[level] of their
+// coverage, levels below min are skipped unless opaque.  With BLEND the
+// partial levels of transparent text are blended into the canvas by
+//   void blend(coord_t x0, coord_t y0, coord_t x1, coord_t y1, unsigned level);
+// of the sink instead.
+template<class S, bool BLEND>
+struct LevelDrawer {
+	S &s;
+	coord_t x, y;
+	const int8_t *mrot;
+	coord_t size;
+	const color_t *ramp;
+	unsigned min, max;
+	bool opaque;
+
+	void operator()(coord_t j, coord_t i0, coord_t i1, unsigned level) {
+		if (level < min && !opaque)
+			return;
+		rect_t r;
+		runRect(x, y, mrot, size, j, i0, i1, r);
+		if (!opaque && level < max)
+			PartialLevel<BLEND>::draw(s, r, level, ramp[level]);
+		else
+			s.rect(r.x0, r.y0, r.x1, r.y1, ramp[level]);
+	}
+};
+
+// Runs previously collected with scanRuns()
+template<class S>
+void runs(S &s, coord_t x, coord_t y, const int8_t *mrot, const run_t *runs, size_t n,
+		coord_t size, color_t fg, color_t bg, bool opaque) {
+	RunDrawer<S> draw = { s, x, y, mrot, size, fg, bg, opaque };
+	for (size_t i = 0; i < n; i++) {
+		draw(runs[i].y, runs[i].x0, runs[i].x1, runs[i].level);
+	}
+}
+
+// Runs previously collected with scanLevels(), see LevelDrawer
+template<bool BLEND, class S>
+void levels(S &s, coord_t x, coord_t y, const int8_t *mrot, const run_t *runs, size_t n,
+		coord_t size, const color_t *ramp, unsigned min, unsigned max, bool opaque) {
+	LevelDrawer<S, BLEND> draw = { s, x, y, mrot, size, ramp, min, max, opaque };
+	for (size_t i = 0; i < n; i++) {
+		draw(runs[i].y, runs[i].x0, runs[i].x1, runs[i].level);
+	}
+}
+
+// 1-bit bitmap, see scanRuns() and RunDrawer
+template<class S>
+void bitmap(S &s, coord_t x, coord_t y, const int8_t *mrot, const uint8_t *bits, size_t stride,
+		coord_t w, coord_t h, coord_t size, color_t fg, color_t bg, bool opaque) {
+	RunDrawer<S> draw = { s, x, y, mrot, size, fg, bg, opaque };
+	scanRuns(bits, stride, w, h, draw);
+}
+
+}
+
+}
+
+#endif // _PRIMITIVES_H_
@@ -0,0 +1,181 @@
+#ifndef _TEXTLAYOUT_H_
+#define _TEXTLAYOUT_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "PixelFormat.h"
+#include "gfxfont.h"
+
+namespace GFX {
+
+class PreparedFont;
+
+// Glyph placed by the text layout at device position (x,y), the
+// arguments of Canvas::writeGlyph().  The bitmap has bpp bits per pixel
+// and rows 'stride' pixels apart.
+struct glyph_t {
+	coord_t x, y;
+	const void *font;
+	uint32_t code;
+	const uint8_t *bitmap;
+	size_t stride;
+	coord_t w, h;
+	uint8_t bpp;
+};
+
+enum TextAlign {
+	ALIGN_LEFT, ALIGN_CENTER, ALIGN_RIGHT
+};
+
+// A string measured and broken into lines once, so it can be drawn any
+// number of times without walking it again.  Built by
+// Canvas::getTextLayout() and drawn by Canvas::drawText().  Positions are
+// logical (unrotated) and relative to the origin passed to drawText(),
+// which is the cursor position the string would be printed at.
+class TextLayout {
+public:
+	TextLayout() : font(NULL), size(1), lines(0) {
+		bounds.x0 = bounds.y0 = 0;
+		bounds.x1 = bounds.y1 = -1;
+	}
+
+	// GFXfont or GFXfont2 of the text, NULL for the classic font
+	const void *getFont() const {
+		return font;
+	}
+	coord_t getSize() const {
+		return size;
+	}
+	// Glyphs with a bitmap, x/y is the top-left corner of the bitmap
+	const std::vector<glyph_t> &getGlyphs() const {
+		return glyphs;
+	}
+	// Index of the first glyph of every line but the first one
+	const std::vector<size_t> &getLineBreaks() const {
+		return breaks;
+	}
+	size_t getLineCount() const {
+		return lines;
+	}
+	// Background box of every line of custom font text, from the top to
+	// the bottom of the font and over the pen movement.  Empty boxes have
+	// x1 < x0, there are none for the classic font.
+	const std::vector<rect_t> &getLineBoxes() const {
+		return boxes;
+	}
+	// Bounding box of all glyphs like getTextBounds() at origin (0,0)
+	void getBounds(coord_t *x0, coord_t *y0, coord_t *w, coord_t *h) const {
+		*x0 = bounds.x0;
+		*y0 = bounds.y0;
+		*w = bounds.x1 - bounds.x0 + 1;
+		*h = bounds.y1 - bounds.y0 + 1;
+	}
+	bool empty() const {
+		return glyphs.empty();
+	}
+
+private:
+	friend class Canvas;
+
+	const void *font;
+	// font the glyph bitmaps point into if the canvas repacked it, kept
+	// alive while the layout or a copy of it exists
+	std::shared_ptr<const PreparedFont> prepared;
+	coord_t size;
+	size_t lines;
+	std::vector<glyph_t> glyphs;
+	std::vector<size_t> breaks;
+	std::vector<rect_t> boxes;
+	rect_t bounds;
+};
+
+// Layouts keyed by font, text size, alignment, box width, wrap limit and
+// string.  Holds layouts of at most 'limit' bytes, it is emptied when
+// full.
+class TextLayoutCache {
+public:
+	struct Key {
+		const void *font;
+		coord_t size;
+		TextAlign align;
+		coord_t width;
+		coord_t limit;
+		size_t hash;
+
+		bool operator==(const Key &o) const {
+			return font == o.font && size == o.size && align == o.align
+					&& width == o.width && limit == o.limit && hash == o.hash;
+		}
+	};
+
+	TextLayoutCache(size_t limit) : used(0), limit(limit) {
+		//nothing
+	}
+
+	void clear() {
+		entries.clear();
+		used = 0;
+	}
+
+	// Cached layout of str, NULL if there is none
+	const TextLayout *find(const Key &key, const std::string &str) const {
+		std::unordered_map<Key, Entry, KeyHash>::const_iterator it = entries.find(key);
+		if (it == entries.end() || it->second.text != str)
+			return NULL;
+		return &it->second.layout;
+	}
+
+	// Slot for the layout of str, replaces a colliding entry
+	TextLayout &insert(const Key &key, const std::string &str) {
+		if (used > limit)
+			clear();
+		Entry &e = entries[key];
+		used -= e.bytes;
+		e.bytes = 0;
+		e.text = str;
+		e.layout = TextLayout();
+		return e.layout;
+	}
+
+	// Account for the memory of the layout filled in after insert(key)
+	void commit(const Key &key) {
+		Entry &e = entries[key];
+		const TextLayout &l = e.layout;
+		e.bytes = sizeof(Entry) + e.text.size() + l.getGlyphs().size() * sizeof(glyph_t)
+				+ l.getLineBreaks().size() * sizeof(size_t)
+				+ l.getLineBoxes().size() * sizeof(rect_t);
+		used += e.bytes;
+	}
+
+private:
+	struct Entry {
+		std::string text;
+		TextLayout layout;
+		size_t bytes; // counted in used, 0 until commit()
+
+		Entry() : bytes(0) {
+			//nothing
+		}
+	};
+	struct KeyHash {
+		size_t operator()(const Key &k) const {
+			size_t h = (size_t)k.font;
+			h = h * 31 + k.size;
+			h = h * 31 + k.align;
+			h = h * 31 + k.width;
+			h = h * 31 + k.limit;
+			return h * 31 + k.hash;
+		}
+	};
+
+	std::unordered_map<Key, Entry, KeyHash> entries;
+	size_t used;
+	size_t limit;
+};
+
+}
+
+#endif // _TEXTLAYOUT_H_
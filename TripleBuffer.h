@@ -0,0 +1,46 @@
+#ifndef _TRIPLEBUFFER_H_
+#define _TRIPLEBUFFER_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace GFX {
+
+// Lock-free single producer / single consumer mailbox for three slots.
+// The producer owns one slot (back), the consumer one (front) and the
+// third one is in the mailbox.  Publishing and taking exchange the own
+// slot with the one in the mailbox, so neither side ever waits and the
+// consumer always gets the newest published slot.
+class TripleBuffer {
+public:
+	TripleBuffer() : middle(1) {
+		//nothing
+	}
+
+	// Producer: hand over slot back, returns the slot to continue with.
+	// dropped is set if the previously published slot was never taken.
+	unsigned publish(unsigned back, bool &dropped) {
+		uint8_t old = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+		dropped = (old & FRESH) != 0;
+		return old & INDEX;
+	}
+
+	// Consumer: exchange slot front for the newest published one.
+	// Returns false and leaves front alone if nothing new was published.
+	bool take(unsigned &front) {
+		if (!(middle.load(std::memory_order_relaxed) & FRESH))
+			return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+
+private:
+	static const uint8_t INDEX = 0x03;
+	static const uint8_t FRESH = 0x04;
+
+	std::atomic<uint8_t> middle;
+};
+
+}
+
+#endif // _TRIPLEBUFFER_H_
@@ -0,0 +1,71 @@
+#ifndef _UTF8_H_
+#define _UTF8_H_
+
+#include <cstdint>
+
+namespace GFX {
+
+// Incremental UTF-8 decoder, sequences may be split across calls.
+// Bytes that cannot start a sequence, overlong forms, surrogates and
+// values above U+10FFFF are decoded as REPLACEMENT.
+class Utf8Decoder {
+public:
+	static const uint32_t REPLACEMENT = 0xFFFD;
+
+	Utf8Decoder() : code(0), min(0), need(0) {
+		//nothing
+	}
+
+	void reset() {
+		need = 0;
+	}
+
+	// Decode the next byte, returns the number of code points (0 to 2)
+	// stored in out.  A broken sequence yields REPLACEMENT.
+	int feed(uint8_t b, uint32_t out[2]) {
+		int n = 0;
+		if (need > 0) {
+			if ((b & 0xC0) == 0x80) {
+				code = (code << 6) | (b & 0x3F);
+				if (--need == 0)
+					out[n++] = valid() ? code : REPLACEMENT;
+				return n;
+			}
+			need = 0;
+			out[n++] = REPLACEMENT;
+		}
+
+		if (b < 0x80) {
+			out[n++] = b;
+		} else if (b >= 0xC2 && b <= 0xDF) {
+			code = b & 0x1F;
+			min = 0x80;
+			need = 1;
+		} else if ((b & 0xF0) == 0xE0) {
+			code = b & 0x0F;
+			min = 0x800;
+			need = 2;
+		} else if (b >= 0xF0 && b <= 0xF4) {
+			code = b & 0x07;
+			min = 0x10000;
+			need = 3;
+		} else {
+			out[n++] = REPLACEMENT;
+		}
+		return n;
+	}
+
+private:
+	// completed sequence is the shortest form of a scalar value
+	bool valid() const {
+		return code >= min && code <= 0x10FFFF && (code < 0xD800 || code > 0xDFFF);
+	}
+
+	uint32_t code;
+	uint32_t min; // smallest value of the sequence length being decoded
+	uint8_t need;
+};
+
+}
+
+#endif // _UTF8_H_
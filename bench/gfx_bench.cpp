@@ -0,0 +1,237 @@
+// Micro-benchmark of the Canvas primitives for every pixel format, a few
+// canvas sizes and all rotations.  Runs without display hardware.
+//
+// Usage: gfx_bench [-t ms] [-L] [filter]
+//   -t ms   minimum measuring time per case (default 50)
+//   -L      stress run on large canvases instead, 8192x8192 and one with
+//           coordinates beyond 32767 (needs about 200 MB)
+//   filter  only run primitives whose name contains this string
+//
+// Prints one CSV line per case:
+//   primitive,format,width,height,rotation,calls,ns_per_call,mpixels_per_s
+// Pixel counts are nominal (the area of the primitive) and only meant to
+// compare runs with each other.  Use a Release build (see cmake.sh).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "../Canvas.h"
+
+using std::chrono::steady_clock;
+using namespace GFX;
+
+static const int POSITIONS = 256;
+
+static const char *filter = NULL;
+static std::chrono::nanoseconds minTime = std::chrono::milliseconds(50);
+
+// 32x32 1-bit test pattern
+static uint8_t pattern[32 * 32 / 8];
+
+struct Case {
+	Canvas &c;
+	coord_t w, h;
+	// pseudo random positions inside the logical canvas
+	coord_t px[POSITIONS], py[POSITIONS];
+};
+
+static void initPositions(Case &cs) {
+	uint32_t seed = 12345;
+	for (int i = 0; i < POSITIONS; i++) {
+		seed = seed * 1103515245 + 12345;
+		cs.px[i] = (seed >> 8) % cs.w;
+		seed = seed * 1103515245 + 12345;
+		cs.py[i] = (seed >> 8) % cs.h;
+	}
+}
+
+// Calls draw(cs, i) with increasing i until minTime has passed and prints
+// the result.  pixels is the nominal number of pixels per call.
+template<class D>
+static void run(const char *name, const char *format, int rotation, Case &cs, double pixels, D draw) {
+	if (filter != NULL && strstr(name, filter) == NULL)
+		return;
+
+	// warm up
+	for (int i = 0; i < 16; i++)
+		draw(cs, i);
+	cs.c.clearDamage();
+
+	uint64_t calls = 0;
+	uint64_t batch = 16;
+	steady_clock::duration elapsed(0);
+	steady_clock::time_point start = steady_clock::now();
+	while (elapsed < minTime) {
+		for (uint64_t i = 0; i < batch; i++)
+			draw(cs, (int)((calls + i) % POSITIONS));
+		calls += batch;
+		cs.c.clearDamage();
+		elapsed = steady_clock::now() - start;
+		batch *= 2;
+	}
+
+	double ns = std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+	printf("%s,%s,%d,%d,%d,%llu,%.1f,%.2f\n", name, format, (int)cs.c.getWidth(), (int)cs.c.getHeight(),
+			rotation, (unsigned long long)calls, ns, pixels * 1e3 / ns);
+	fflush(stdout);
+}
+
+static void fillRectSmall(Case &cs, int i) {
+	cs.c.fillRect(cs.px[i], cs.py[i], cs.px[i] + 15, cs.py[i] + 15);
+}
+
+static void fillRectLarge(Case &cs, int i) {
+	coord_t x = cs.px[i] / 2, y = cs.py[i] / 2;
+	cs.c.fillRect(x, y, x + cs.w / 2 - 1, y + cs.h / 2 - 1);
+}
+
+static void drawLine(Case &cs, int i) {
+	int j = (i + 1) % POSITIONS;
+	cs.c.drawLine(cs.px[i], cs.py[i], cs.px[j], cs.py[j]);
+}
+
+static void fillCircleSmall(Case &cs, int i) {
+	cs.c.fillCircle(cs.px[i], cs.py[i], 8);
+}
+
+static void fillCircleLarge(Case &cs, int i) {
+	cs.c.fillCircle(cs.w / 2, cs.h / 2, cs.h / 4);
+}
+
+static void fillTriangle(Case &cs, int i) {
+	int j = (i + 1) % POSITIONS, k = (i + 2) % POSITIONS;
+	cs.c.fillTriangle(cs.px[i], cs.py[i], cs.px[j], cs.py[j], cs.px[k], cs.py[k]);
+}
+
+static void drawBitmap(Case &cs, int i) {
+	cs.c.drawBitmap(cs.px[i], cs.py[i], pattern, 32, 32);
+}
+
+static const char *text = "Hello World!";
+
+static void drawText(Case &cs, int i) {
+	cs.c.setCursor(cs.px[i], cs.py[i]);
+	cs.c.print(text);
+}
+
+static void drawLayout(Case &cs, int i) {
+	cs.c.drawText(cs.c.getTextLayout(text), cs.px[i], cs.py[i]);
+}
+
+static void clearScreen(Case &cs, int i) {
+	cs.c.clearScreen();
+}
+
+// average length of the lines between consecutive positions
+static double lineLength(const Case &cs) {
+	double sum = 0;
+	for (int i = 0; i < POSITIONS; i++) {
+		int j = (i + 1) % POSITIONS;
+		sum += std::max(abs(cs.px[i] - cs.px[j]), abs(cs.py[i] - cs.py[j])) + 1;
+	}
+	return sum / POSITIONS;
+}
+
+// average area of the triangles between consecutive positions
+static double triangleArea(const Case &cs) {
+	double sum = 0;
+	for (int i = 0; i < POSITIONS; i++) {
+		int j = (i + 1) % POSITIONS, k = (i + 2) % POSITIONS;
+		double a = (double)(cs.px[j] - cs.px[i]) * (cs.py[k] - cs.py[i])
+				- (double)(cs.px[k] - cs.px[i]) * (cs.py[j] - cs.py[i]);
+		sum += fabs(a) / 2;
+	}
+	return sum / POSITIONS;
+}
+
+static double textPixels(Canvas &c) {
+	coord_t x0, y0, w, h;
+	c.getTextBounds(const_cast<char*>(text), 0, 0, &x0, &y0, &w, &h);
+	return (double)w * h;
+}
+
+template<class F>
+static void runFormat(const char *format, coord_t width, coord_t height) {
+	CanvasT<F> canvas(width, height);
+	canvas.setBgColor(COLOR_BLACK);
+	canvas.setDrawColor(COLOR_WHITE);
+	canvas.setTextWrap(false);
+
+	for (int rotation = 0; rotation < 4; rotation++) {
+		canvas.setRotation(rotation);
+		Case cs = { canvas, canvas.getWidth(), canvas.getHeight() };
+		initPositions(cs);
+		double w = cs.w, h = cs.h;
+
+		run("fillRect16", format, rotation, cs, 16 * 16, fillRectSmall);
+		run("fillRectHalf", format, rotation, cs, (w / 2) * (h / 2), fillRectLarge);
+		run("drawLine", format, rotation, cs, lineLength(cs), drawLine);
+		run("fillCircle8", format, rotation, cs, 3.1416 * 8 * 8, fillCircleSmall);
+		run("fillCircleQuarter", format, rotation, cs, 3.1416 * (h / 4) * (h / 4), fillCircleLarge);
+		run("fillTriangle", format, rotation, cs, triangleArea(cs), fillTriangle);
+		run("drawBitmap32", format, rotation, cs, 32 * 32, drawBitmap);
+
+		canvas.setFont(NULL);
+		canvas.setTextSize(1);
+		canvas.setTextColor(COLOR_WHITE);
+		run("textClassic", format, rotation, cs, textPixels(canvas), drawText);
+		run("textLayout", format, rotation, cs, textPixels(canvas), drawLayout);
+		canvas.setTextColor(COLOR_WHITE, COLOR_BLACK);
+		run("textClassicOpaque", format, rotation, cs, textPixels(canvas), drawText);
+		canvas.setTextSize(2);
+		canvas.setTextColor(COLOR_WHITE);
+		run("textClassic2x", format, rotation, cs, textPixels(canvas), drawText);
+		canvas.setTextSize(1);
+		canvas.setFont(&FreeSans9pt7b);
+		run("textGFX9pt", format, rotation, cs, textPixels(canvas), drawText);
+		canvas.setTextFill(true);
+		canvas.setTextColor(COLOR_WHITE, COLOR_BLACK);
+		run("textGFX9ptFill", format, rotation, cs, textPixels(canvas), drawText);
+		canvas.setTextFill(false);
+		canvas.setTextColor(COLOR_WHITE);
+		canvas.setFont(&FreeSans18pt7b);
+		run("textGFX18pt", format, rotation, cs, textPixels(canvas), drawText);
+		canvas.setFont(NULL);
+
+		run("clearScreen", format, rotation, cs, w * h, clearScreen);
+	}
+}
+
+static void runSize(coord_t width, coord_t height) {
+	runFormat<Format1bpp>("1bpp", width, height);
+	runFormat<Format4bpp>("4bpp", width, height);
+	runFormat<Format8bpp>("8bpp", width, height);
+	runFormat<Format16bpp>("16bpp", width, height);
+}
+
+int main(int argc, char **argv) {
+	bool large = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			minTime = std::chrono::milliseconds(atoi(argv[++i]));
+		} else if (strcmp(argv[i], "-L") == 0) {
+			large = true;
+		} else {
+			filter = argv[i];
+		}
+	}
+
+	for (size_t i = 0; i < sizeof(pattern); i++)
+		pattern[i] = (i & 4) ? 0xAA : 0x5A;
+
+	printf("primitive,format,width,height,rotation,calls,ns_per_call,mpixels_per_s\n");
+	if (large) {
+		runSize(8192, 8192);
+		runSize(40000, 1200);
+		return 0;
+	}
+	runSize(128, 128);
+	runSize(320, 240);
+	runSize(800, 480);
+	return 0;
+}
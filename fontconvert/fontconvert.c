@@ -10,70 +10,577 @@ For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
 
 REQUIRES FREETYPE LIBRARY.  www.freetype.org
 
-Currently this only extracts the printable 7-bit ASCII chars of a font.
-Will eventually extend with some int'l chars a la ftGFX, not there yet.
-Keep 7-bit fonts around as an option in that case, more compact.
+By default this extracts the printable 7-bit ASCII chars of a font.
+With -2 it writes a version 2 font (GFXfont2) with any number of Unicode
+code point ranges instead, e.g. ASCII, Latin-1 and Latin Extended-A:
+  ./fontconvert -2 FreeSans.ttf 12 0x20-0x7E 0xA0-0x17F > FreeSans12ptU.c
+Code points the font has no glyph for are left out.  Kerning pairs of
+the font's 'kern' table are included (GPOS kerning is not read by
+FreeType and thus skipped), -k before the other options leaves them
+out.  Keep 7-bit fonts
+around for ASCII-only text, they are more compact.  -a2 and -a4 work like
+-2 but write anti-aliased glyphs with 2 resp. 4 bits of coverage per
+pixel, for grayscale and color displays.
+
+With -b, before the other options, the font is written as a binary font
+file (see GFXfontFile in gfxfont.h) instead of C source, to be loaded at
+run time with FontFile or FontRegistry:
+  ./fontconvert -b -2 FreeSans.ttf 12 0x20-0x7E > FreeSans12ptU.gfx
 
 See notes at end for glyph nomenclature & other tidbits.
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <stdint.h>
 #include <ft2build.h>
 #include FT_GLYPH_H
+#include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_TAGS_H
 #include "../gfxfont.h" // Adafruit_GFX font structures
 
 #define DPI 141 // Approximate res. of Adafruit 2.8" TFT
 
-// Accumulate bits for output, with periodic hexadecimal byte write
+// Fonts with kerning but no 'kern' table (e.g. Type 1 with AFM) are
+// kerned by trying every pair of glyphs, only up to this many glyphs
+#define KERN_SCAN_MAX 1024
+
+// Bitmap bytes of all glyphs, collected by enbit()
+uint8_t *bitmapData = NULL;
+int      bitmapSize = 0, bitmapAlloc = 0;
+
+// Accumulate bits for output, with periodic byte append to bitmapData
 void enbit(uint8_t value) {
-	static uint8_t row = 0, sum = 0, bit = 0x80, firstCall = 1;
+	static uint8_t sum = 0, bit = 0x80;
 	if(value) sum |= bit;    // Set bit if needed
 	if(!(bit >>= 1)) {       // Advance to next bit, end of byte reached?
-		if(!firstCall) { // Format output table nicely
-			if(++row >= 12) {        // Last entry on line?
-				printf(",\n  "); //   Newline format output
-				row = 0;         //   Reset row counter
-			} else {                 // Not end of line
-				printf(", ");    //   Simple comma delim
+		if(bitmapSize == bitmapAlloc) {
+			bitmapAlloc = bitmapAlloc ? bitmapAlloc * 2 : 4096;
+			if(!(bitmapData = (uint8_t *)realloc(bitmapData,
+			  bitmapAlloc))) {
+				fprintf(stderr, "Malloc error\n");
+				exit(1);
 			}
 		}
-		printf("0x%02X", sum); // Write byte value
+		bitmapData[bitmapSize++] = sum; // Store byte value
 		sum       = 0;         // Clear for next byte
 		bit       = 0x80;      // Reset bit counter
-		firstCall = 0;         // Formatting flag
 	}
 }
 
+// Output the bitmap bytes in hexadecimal, 12 per line
+void printBitmap(void) {
+	int i;
+	for(i=0; i<bitmapSize; i++) {
+		if(i) printf((i % 12) ? ", " : ",\n  ");
+		printf("0x%02X", bitmapData[i]);
+	}
+}
+
+// Write a binary font file of the sections to stdout.  The caller fills
+// in the font fields and section lengths of file, offsets are assigned
+// here.  Returns 0 on success.
+int writeFile(GFXfontFile *file, const void *sections[GFX_FILE_SECTIONS]) {
+	static const uint8_t pad[4] = { 0 };
+	uint32_t             offset = sizeof(GFXfontFile);
+	int                  i;
+
+	file->magic   = GFX_FILE_MAGIC;
+	file->version = GFX_FILE_VERSION;
+	for(i=0; i<GFX_FILE_SECTIONS; i++) {
+		file->offset[i] = file->length[i] ? offset : 0;
+		offset += (file->length[i] + 3) & ~3;
+	}
+	if(fwrite(file, sizeof(GFXfontFile), 1, stdout) != 1) goto error;
+	for(i=0; i<GFX_FILE_SECTIONS; i++) {
+		if(!file->length[i]) continue;
+		if((fwrite(sections[i], 1, file->length[i], stdout) !=
+		  file->length[i]) ||
+		   (fwrite(pad, 1, -file->length[i] & 3, stdout) !=
+		  (-file->length[i] & 3))) goto error;
+	}
+	if(!fflush(stdout)) return 0;
+error:
+	fprintf(stderr, "Write error\n");
+	return 1;
+}
+
+// Render code point cp with bpp bits per pixel and output its bitmap
+// through enbit(), padded to the next byte boundary.  Returns the number
+// of bytes, -1 on error.
+int renderChar(FT_Face face, uint32_t cp, int bpp, int *width,
+  int *height, int *xAdvance, int *xOffset, int *yOffset) {
+	int                err, x, y, byte, level, b;
+	FT_Glyph           glyph;
+	FT_Bitmap         *bitmap;
+	FT_BitmapGlyphRec *g;
+	uint8_t            bit;
+
+	// MONO renderer provides clean image with perfect crop
+	// (no wasted pixels) via bitmap struct.  So does the NORMAL
+	// renderer for anti-aliased glyphs, with 8-bit coverage.
+	if((err = FT_Load_Char(face, cp, (bpp > 1) ?
+	  FT_LOAD_TARGET_NORMAL : FT_LOAD_TARGET_MONO))) {
+		fprintf(stderr, "Error %d loading char 0x%02X\n", err, cp);
+		return -1;
+	}
+
+	if((err = FT_Render_Glyph(face->glyph, (bpp > 1) ?
+	  FT_RENDER_MODE_NORMAL : FT_RENDER_MODE_MONO))) {
+		fprintf(stderr, "Error %d rendering char 0x%02X\n", err, cp);
+		return -1;
+	}
+
+	if((err = FT_Get_Glyph(face->glyph, &glyph))) {
+		fprintf(stderr, "Error %d getting glyph 0x%02X\n", err, cp);
+		return -1;
+	}
+
+	bitmap = &face->glyph->bitmap;
+	g      = (FT_BitmapGlyphRec *)glyph;
+
+	*width    = bitmap->width;
+	*height   = bitmap->rows;
+	*xAdvance = face->glyph->advance.x >> 6;
+	*xOffset  = g->left;
+	*yOffset  = 1 - g->top;
+
+	for(y=0; y < bitmap->rows; y++) {
+		for(x=0;x < bitmap->width; x++) {
+			if(bpp > 1) {
+				// Coverage 0-255 rounded to bpp bits, MSB first
+				level = (bitmap->buffer[y * bitmap->pitch + x] *
+				  ((1 << bpp) - 1) + 127) / 255;
+				for(b=bpp-1; b>=0; b--) enbit(level & (1 << b));
+				continue;
+			}
+			byte = x / 8;
+			bit  = 0x80 >> (x & 7);
+			enbit(bitmap->buffer[
+			  y * bitmap->pitch + byte] & bit);
+		}
+	}
+
+	// Pad end of char bitmap to next byte boundary if needed
+	int n = (bitmap->width * bitmap->rows * bpp) & 7;
+	if(n) { // Bit count not an even multiple of 8?
+		n = 8 - n; // # bits to next multiple
+		while(n--) enbit(0);
+	}
+
+	FT_Done_Glyph(glyph);
+	return (bitmap->width * bitmap->rows * bpp + 7) / 8;
+}
+
+int compareCodes(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+int compareGlyphs(const void *a, const void *b) {
+	const FT_UInt *x = (const FT_UInt *)a, *y = (const FT_UInt *)b;
+	return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+// Pairs (i << 16 | j) of the n glyphs with FreeType indices ftIndex[]
+// that the font's 'kern' table lists, sorted and without duplicates.
+// Like FreeType, only horizontal format 0 subtables of version 0 tables
+// are read.  Returns the number of pairs, -1 if there is no such table.
+int kernCandidates(FT_Face face, const FT_UInt *ftIndex, int n,
+  uint32_t **pairs) {
+	FT_ULong  len = 0, p, next;
+	FT_Byte  *kern;
+	FT_UInt  *order, key[2];
+	uint32_t *out = NULL, pair;
+	int       i, t, tables, count = 0, max = 0, coverage, nPairs;
+	FT_UInt  *l0, *r0, *l, *r, *end;
+
+#define U16(o) ((FT_UInt)((kern[o] << 8) | kern[(o) + 1]))
+	if(FT_Load_Sfnt_Table(face, TTAG_kern, 0, NULL, &len) || (len < 4))
+		return -1;
+	if((!(kern = (FT_Byte *)malloc(len))) ||
+	   (!(order = (FT_UInt *)malloc(n * 2 * sizeof(FT_UInt))))) {
+		fprintf(stderr, "Malloc error\n");
+		exit(1);
+	}
+	if(FT_Load_Sfnt_Table(face, TTAG_kern, 0, kern, &len) || U16(0)) {
+		free(kern);
+		free(order);
+		return -1;
+	}
+
+	// (FreeType index, glyph) sorted by index, several code points may
+	// share a glyph
+	for(i=0; i<n; i++) {
+		order[2 * i]     = ftIndex[i];
+		order[2 * i + 1] = i;
+	}
+	qsort(order, n, 2 * sizeof(FT_UInt), compareGlyphs);
+	end = order + 2 * n;
+
+	tables = U16(2);
+	for(t=0, p=4; (t<tables) && (p + 14 <= len); t++, p=next) {
+		coverage = U16(p + 4);
+		nPairs   = U16(p + 6);
+		// the 16-bit length overflows for large tables, trust nPairs
+		next     = ((coverage >> 8) == 0) ? p + 14 + nPairs * 6 :
+		  p + U16(p + 2);
+		if(next <= p) break;
+		if((coverage & ~8) != 0x0001) continue; // horizontal format 0
+		for(i=0; (i<nPairs) && (p + 14 + i * 6 + 6 <= len); i++) {
+			key[0] = U16(p + 14 + i * 6);
+			l0 = (FT_UInt *)bsearch(key, order, n, 2 * sizeof(FT_UInt),
+			  compareGlyphs);
+			key[0] = U16(p + 16 + i * 6);
+			r0 = (FT_UInt *)bsearch(key, order, n, 2 * sizeof(FT_UInt),
+			  compareGlyphs);
+			if(!l0 || !r0) continue;
+			// first and following entries of the same index
+			while((l0 > order) && (l0[-2] == l0[0])) l0 -= 2;
+			while((r0 > order) && (r0[-2] == r0[0])) r0 -= 2;
+			for(l=l0; (l<end) && (l[0] == l0[0]); l+=2) {
+				for(r=r0; (r<end) && (r[0] == r0[0]); r+=2) {
+					if(count == max) {
+						max = max ? max * 2 : 256;
+						if(!(out = (uint32_t *)realloc(out,
+						  max * sizeof(uint32_t)))) {
+							fprintf(stderr, "Malloc error\n");
+							exit(1);
+						}
+					}
+					out[count++] = ((uint32_t)l[1] << 16) | r[1];
+				}
+			}
+		}
+	}
+#undef U16
+	free(kern);
+	free(order);
+
+	qsort(out, count, sizeof(uint32_t), compareCodes);
+	for(i=0, t=0; i<count; i++) {
+		pair = out[i];
+		if(!t || (out[t-1] != pair)) out[t++] = pair;
+	}
+	*pairs = out;
+	return t;
+}
+
+// Output a uint16_t array, 12 values per line
+void printTable(const char *name, const uint16_t *values, int count) {
+	int i;
+	printf("static const uint16_t %s[] = {\n  ", name);
+	for(i=0; i<count; i++) {
+		printf("0x%04X", values[i]);
+		if(i < count - 1) printf((i % 12 == 11) ? ",\n  " : ", ");
+	}
+	printf(" };\n\n");
+}
+
+// Output a version 2 font (see GFXfont2 in gfxfont.h) of the given code
+// points.  Glyphs are stored in code point order; pages[cp >> 8] is the
+// index block + 1 of each 256 code point page, 0 if the page is empty,
+// and index[block * 256 + (cp & 0xFF)] the glyph + 1, 0 if absent.
+// Glyphs have bpp bits per pixel, more than 1 is anti-aliased.  Kerning
+// pairs are left out unless kern is set.  The font is written to file if
+// it is not NULL, as C source otherwise.
+int convert2(FT_Face face, const char *fontName, int bpp, int kern,
+  uint32_t *codes, int count, GFXfontFile *file) {
+	int        i, j, k, n = 0, bitmapOffset = 0, pageCount, blocks = 0,
+	           w, h, xa, xo, yo, bytes, kernCount = 0, kernMax = 0,
+	           filterBytes, yAdvance, err = 0, p, pairCount;
+	char      *name;
+	GFXglyph2 *table;
+	uint32_t  *present, *kernPairs = NULL, *candidates = NULL;
+	uint16_t  *pages, *index;
+	int8_t    *kernAmounts = NULL;
+	uint8_t   *kernFilter;
+	FT_UInt   *ftIndex;
+	FT_Vector  delta;
+
+	qsort(codes, count, sizeof(uint32_t), compareCodes);
+	if((!(name = malloc(strlen(fontName) + 20))) ||
+	   (!(table = (GFXglyph2 *)malloc(count * sizeof(GFXglyph2)))) ||
+	   (!(present = (uint32_t *)malloc(count * sizeof(uint32_t))))) {
+		fprintf(stderr, "Malloc error\n");
+		return 1;
+	}
+
+	for(i=0; i<count; i++) {
+		if((i > 0) && (codes[i] == codes[i-1])) continue; // Duplicate
+		if(!FT_Get_Char_Index(face, codes[i])) continue; // Not in font
+		if(n == 0xFFFF) {
+			fprintf(stderr, "Too many glyphs, stopping at 0x%02X\n",
+			  codes[i]);
+			break;
+		}
+		if((bytes = renderChar(face, codes[i], bpp,
+		  &w, &h, &xa, &xo, &yo)) < 0) continue;
+
+		// 32-bit offsets, so bitmaps may exceed 64K
+		table[n].bitmapOffset = bitmapOffset;
+		table[n].width        = w;
+		table[n].height       = h;
+		table[n].xAdvance     = xa;
+		table[n].xOffset      = xo;
+		table[n].yOffset      = yo;
+		present[n++]          = codes[i];
+		bitmapOffset         += bytes;
+	}
+	if(!n) {
+		fprintf(stderr, "No glyphs in the given ranges\n");
+		return 1;
+	}
+
+	// Two-level lookup table, one index block per used page
+	pageCount = (present[n-1] >> 8) + 1;
+	if(!(pages = (uint16_t *)calloc(pageCount, sizeof(uint16_t)))) {
+		fprintf(stderr, "Malloc error\n");
+		return 1;
+	}
+	for(i=0; i<n; i++) {
+		if(!pages[present[i] >> 8]) pages[present[i] >> 8] = ++blocks;
+	}
+	if(!(index = (uint16_t *)calloc(blocks * 256, sizeof(uint16_t)))) {
+		fprintf(stderr, "Malloc error\n");
+		return 1;
+	}
+	for(i=0; i<n; i++) {
+		index[(pages[present[i] >> 8] - 1) * 256 +
+		  (present[i] & 0xFF)] = i + 1;
+	}
+
+	// Kerning pairs between the glyphs, sorted by left then right glyph
+	filterBytes = (n + 7) / 8;
+	if((!(ftIndex = (FT_UInt *)malloc(n * sizeof(FT_UInt)))) ||
+	   (!(kernFilter = (uint8_t *)calloc(2 * filterBytes, 1)))) {
+		fprintf(stderr, "Malloc error\n");
+		return 1;
+	}
+	for(i=0; i<n; i++) ftIndex[i] = FT_Get_Char_Index(face, present[i]);
+	// Only the pairs of the 'kern' table, trying all n * n pairs takes
+	// ages for large Unicode subsets
+	pairCount = 0;
+	if(kern && FT_HAS_KERNING(face)) {
+		pairCount = kernCandidates(face, ftIndex, n, &candidates);
+		if((pairCount < 0) && (n > KERN_SCAN_MAX)) {
+			fprintf(stderr, "No 'kern' table and more than %d glyphs, "
+			  "kerning skipped\n", KERN_SCAN_MAX);
+			pairCount = 0;
+		} else if(pairCount < 0) {
+			pairCount = n * n;
+		}
+	}
+	for(p=0; p<pairCount; p++) {
+		i = candidates ? (int)(candidates[p] >> 16)    : p / n;
+		j = candidates ? (int)(candidates[p] & 0xFFFF) : p % n;
+		if(FT_Get_Kerning(face, ftIndex[i], ftIndex[j],
+		  FT_KERNING_DEFAULT, &delta)) continue;
+		k = (delta.x + 32) >> 6; // 26.6 to whole pixels
+		if(!k) continue;
+		if(k < -128) k = -128;
+		if(k >  127) k =  127;
+		if(kernCount == kernMax) {
+			kernMax = kernMax ? kernMax * 2 : 256;
+			if((!(kernPairs = (uint32_t *)realloc(kernPairs,
+			  kernMax * sizeof(uint32_t)))) ||
+			   (!(kernAmounts = (int8_t *)realloc(kernAmounts,
+			  kernMax)))) {
+				fprintf(stderr, "Malloc error\n");
+				return 1;
+			}
+		}
+		kernPairs[kernCount]     = ((uint32_t)i << 16) | j;
+		kernAmounts[kernCount++] = k;
+		kernFilter[i >> 3] |= 0x80 >> (i & 7);
+		kernFilter[filterBytes + (j >> 3)] |= 0x80 >> (j & 7);
+	}
+	free(candidates);
+	if (face->size->metrics.height == 0) {
+		// No face height info, assume fixed width and get from a glyph.
+		yAdvance = table[0].height;
+	} else {
+		yAdvance = face->size->metrics.height >> 6;
+	}
+
+	if(file) {
+		const void *sections[GFX_FILE_SECTIONS] = { bitmapData, table,
+		  pages, index, kernPairs, kernAmounts, kernFilter };
+		file->format     = 2;
+		file->bpp        = bpp;
+		file->yAdvance   = yAdvance;
+		file->pageCount  = pageCount;
+		file->glyphCount = n;
+		file->kernCount  = kernCount;
+		file->length[GFX_FILE_BITMAP]       = bitmapOffset;
+		file->length[GFX_FILE_GLYPHS]       = n * sizeof(GFXglyph2);
+		file->length[GFX_FILE_PAGES]        = pageCount * sizeof(uint16_t);
+		file->length[GFX_FILE_INDEX]        = blocks * 256 * sizeof(uint16_t);
+		if(kernCount) {
+			file->length[GFX_FILE_KERN_PAIRS]   = kernCount * sizeof(uint32_t);
+			file->length[GFX_FILE_KERN_AMOUNTS] = kernCount;
+			file->length[GFX_FILE_KERN_FILTER]  = 2 * filterBytes;
+		}
+		err = writeFile(file, sections);
+		goto done;
+	}
+
+	printf("#include \"../gfxfont.h\"\n"
+			"\n"
+			"static const uint8_t %sBitmaps[] = {\n  ", fontName);
+	printBitmap();
+	if(!bitmapOffset) printf("0x00"); // Only blank glyphs, no empty arrays
+	printf(" };\n\n"); // End bitmap array
+
+	// Output glyph attributes table (one per code point)
+	printf("static const GFXglyph2 %sGlyphs[] = {\n", fontName);
+	for(i=0; i<n; i++) {
+		printf("  { %7d, %3d, %3d, %3d, %4d, %4d }%s // U+%04X",
+		  table[i].bitmapOffset,
+		  table[i].width,
+		  table[i].height,
+		  table[i].xAdvance,
+		  table[i].xOffset,
+		  table[i].yOffset,
+		  (i < n - 1) ? ", " : " };", present[i]);
+		if((present[i] >= ' ') && (present[i] <= '~')) {
+			printf(" '%c'", present[i]);
+		}
+		putchar('\n');
+	}
+	printf("\n");
+
+	sprintf(name, "%sPages", fontName);
+	printTable(name, pages, pageCount);
+	sprintf(name, "%sIndex", fontName);
+	printTable(name, index, blocks * 256);
+
+	if(kernCount) {
+		printf("static const uint32_t %sKernPairs[] = {\n  ", fontName);
+		for(i=0; i<kernCount; i++) {
+			printf("0x%08X", kernPairs[i]);
+			if(i < kernCount - 1) printf((i % 8 == 7) ? ",\n  " : ", ");
+		}
+		printf(" };\n\n");
+		printf("static const int8_t %sKernAmounts[] = {\n  ", fontName);
+		for(i=0; i<kernCount; i++) {
+			printf("%3d", kernAmounts[i]);
+			if(i < kernCount - 1) printf((i % 16 == 15) ? ",\n  " : ", ");
+		}
+		printf(" };\n\n");
+		printf("static const uint8_t %sKernFilter[] = {\n  ", fontName);
+		for(i=0; i<2*filterBytes; i++) {
+			printf("0x%02X", kernFilter[i]);
+			if(i < 2 * filterBytes - 1)
+				printf((i % 12 == 11) ? ",\n  " : ", ");
+		}
+		printf(" };\n\n");
+	}
+
+	// Output font structure
+	printf("const GFXfont2 %s = {\n", fontName);
+	printf("  (uint8_t   *)%sBitmaps,\n", fontName);
+	printf("  (GFXglyph2 *)%sGlyphs,\n", fontName);
+	printf("  (uint16_t  *)%sPages,\n", fontName);
+	printf("  (uint16_t  *)%sIndex,\n", fontName);
+	printf("  %d, %d, %d, %d,\n", pageCount, n, yAdvance, bpp);
+	if(kernCount) {
+		printf("  %d,\n", kernCount);
+		printf("  (uint32_t  *)%sKernPairs,\n", fontName);
+		printf("  (int8_t    *)%sKernAmounts,\n", fontName);
+		printf("  (uint8_t   *)%sKernFilter };\n\n", fontName);
+	} else {
+		printf("  0, NULL, NULL, NULL };\n\n");
+	}
+	printf("// Approx. %d bytes\n", bitmapOffset + n * 12 +
+	  (pageCount + blocks * 256) * 2 + 32 +
+	  (kernCount ? kernCount * 5 + filterBytes * 2 : 0));
+
+done:
+	free(kernFilter);
+	free(kernAmounts);
+	free(kernPairs);
+	free(ftIndex);
+	free(index);
+	free(pages);
+	free(present);
+	free(table);
+	free(name);
+	return err;
+}
+
 int main(int argc, char *argv[]) {
 	int                i, j, err, size, first=' ', last='~',
-	                   bitmapOffset = 0, x, y, byte;
-	char              *fontName, c, *ptr;
+	                   bitmapOffset = 0, v2 = 0, count = 0, kern = 1,
+	                   w, h, xa, xo, yo, bytes, yAdvance, nameLength;
+	long               lo, hi;
+	char              *fontName, c, *ptr, *end;
 	FT_Library         library;
 	FT_Face            face;
-	FT_Glyph           glyph;
-	FT_Bitmap         *bitmap;
-	FT_BitmapGlyphRec *g;
 	GFXglyph          *table;
-	uint8_t            bit;
+	uint32_t          *codes = NULL;
+	GFXfontFile        file, *out = NULL;
 
 	// Parse command line.  Valid syntaxes are:
 	//   fontconvert [filename] [size]
 	//   fontconvert [filename] [size] [last char]
 	//   fontconvert [filename] [size] [first char] [last char]
+	//   fontconvert -2 [filename] [size] [range] [range] ...
+	//   fontconvert -a2 [filename] [size] [range] [range] ...
+	//   fontconvert -a4 [filename] [size] [range] [range] ...
+	// each optionally preceded by -b for binary output and -k to leave
+	// out kerning.
 	// Unless overridden, default first and last chars are
-	// ' ' (space) and '~', respectively
+	// ' ' (space) and '~', respectively.  A range is 'first-last'
+	// or a single code point, decimal or 0x hexadecimal.
+	// v2 is the bits per pixel of version 2 fonts, 0 otherwise.
+
+	memset(&file, 0, sizeof(file));
+	while((argc > 1) && (!strcmp(argv[1], "-b") || !strcmp(argv[1], "-k"))) {
+		if(argv[1][1] == 'b') out  = &file;
+		else                  kern = 0;
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
+	if(argc > 1) {
+		if(!strcmp(argv[1], "-2"))  v2 = 1;
+		if(!strcmp(argv[1], "-a2")) v2 = 2;
+		if(!strcmp(argv[1], "-a4")) v2 = 4;
+	}
+	if(v2) {
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
 
-	if(argc < 3) {
-		fprintf(stderr, "Usage: %s fontfile size [first] [last]\n",
-		  argv[0]);
+	if((argc < 3) || (v2 && (argc < 4))) {
+		fprintf(stderr, "Usage: %s [-b] fontfile size [first] [last]\n"
+		  "       %s [-b] [-k] -2|-a2|-a4 fontfile size range [range ...]\n",
+		  argv[0], argv[0]);
 		return 1;
 	}
 
 	size = atoi(argv[2]);
 
-	if(argc == 4) {
+	if(v2) {
+		for(i=3; i<argc; i++) {
+			lo = hi = strtol(argv[i], &end, 0);
+			if(*end == '-') hi = strtol(end + 1, &end, 0);
+			if(*end || (lo < 0) || (hi < lo) || (hi > 0x10FFFF)) {
+				fprintf(stderr, "Bad range '%s'\n", argv[i]);
+				return 1;
+			}
+			if(!(codes = (uint32_t *)realloc(codes,
+			  (count + hi - lo + 1) * sizeof(uint32_t)))) {
+				fprintf(stderr, "Malloc error\n");
+				return 1;
+			}
+			while(lo <= hi) codes[count++] = lo++;
+		}
+	} else if(argc == 4) {
 		last  = atoi(argv[3]);
 	} else if(argc == 5) {
 		first = atoi(argv[3]);
@@ -92,7 +599,7 @@ int main(int argc, char *argv[]) {
 
 	// Allocate space for font name and glyph table
 	if((!(fontName = malloc(strlen(ptr) + 20))) ||
-	   (!(table = (GFXglyph *)malloc((last - first + 1) *
+	   (!(table = (GFXglyph *)calloc(last - first + 1,
 	    sizeof(GFXglyph))))) {
 		fprintf(stderr, "Malloc error\n");
 		return 1;
@@ -103,13 +610,22 @@ int main(int argc, char *argv[]) {
 	strcpy(fontName, ptr);
 	ptr = strrchr(fontName, '.'); // Find last period (file ext)
 	if(!ptr) ptr = &fontName[strlen(fontName)]; // If none, append
+	nameLength = ptr - fontName; // Without size, for binary files
 	// Insert font size and 7/8 bit.  fontName was alloc'd w/extra
 	// space to allow this, we're not sprintfing into Forbidden Zone.
-	sprintf(ptr, "%dpt%db", size, (last > 127) ? 8 : 7);
+	// Version 2 fonts get a U for Unicode instead, anti-aliased ones
+	// also the bits per pixel.
+	if(v2 > 1)  sprintf(ptr, "%dptU%dbpp", size, v2);
+	else if(v2) sprintf(ptr, "%dptU", size);
+	else        sprintf(ptr, "%dpt%db", size, (last > 127) ? 8 : 7);
 	// Space and punctuation chars in name replaced w/ underscores.  
 	for(i=0; (c=fontName[i]); i++) {
 		if(isspace(c) || ispunct(c)) fontName[i] = '_';
 	}
+	if(nameLength >= (int)sizeof(file.name))
+		nameLength = sizeof(file.name) - 1;
+	memcpy(file.name, fontName, nameLength);
+	file.size = size;
 
 	// Init FreeType lib, load font
 	if((err = FT_Init_FreeType(&library))) {
@@ -125,41 +641,22 @@ int main(int argc, char *argv[]) {
 	// << 6 because '26dot6' fixed-point format
 	FT_Set_Char_Size(face, size << 6, 0, DPI, 0);
 
-	// Currently all symbols from 'first' to 'last' are processed.
-	// Fonts may contain WAY more glyphs than that, but this code
-	// will need to handle encoding stuff to deal with extracting
-	// the right symbols, and that's not done yet.
-	// fprintf(stderr, "%ld glyphs\n", face->num_glyphs);
+	if(v2) {
+		err = convert2(face, fontName, v2, kern, codes, count, out);
+		free(codes);
+		FT_Done_FreeType(library);
+		return err;
+	}
 
-	printf("#include \"../gfxfont.h\"\n"
-			"\n"
-			"static const uint8_t %sBitmaps[] PROGMEM = {\n", fontName);
+	// In 7/8 bit fonts all symbols from 'first' to 'last' are processed.
+	// Fonts may contain WAY more glyphs than that, use -2 to pick
+	// any code points.
+	// fprintf(stderr, "%ld glyphs\n", face->num_glyphs);
 
 	// Process glyphs and output huge bitmap data array
 	for(i=first, j=0; i<=last; i++, j++) {
-		// MONO renderer provides clean image with perfect crop
-		// (no wasted pixels) via bitmap struct.
-		if((err = FT_Load_Char(face, i, FT_LOAD_TARGET_MONO))) {
-			fprintf(stderr, "Error %d loading char '%c'\n",
-			  err, i);
-			continue;
-		}
-
-		if((err = FT_Render_Glyph(face->glyph,
-		  FT_RENDER_MODE_MONO))) {
-			fprintf(stderr, "Error %d rendering char '%c'\n",
-			  err, i);
-			continue;
-		}
-
-		if((err = FT_Get_Glyph(face->glyph, &glyph))) {
-			fprintf(stderr, "Error %d getting glyph '%c'\n",
-			  err, i);
+		if((bytes = renderChar(face, i, 1, &w, &h, &xa, &xo, &yo)) < 0)
 			continue;
-		}
-
-		bitmap = &face->glyph->bitmap;
-		g      = (FT_BitmapGlyphRec *)glyph;
 
 		// Minimal font and per-glyph information is stored to
 		// reduce flash space requirements.  Glyph bitmaps are
@@ -169,33 +666,40 @@ int main(int argc, char *argv[]) {
 		// code currently doesn't check for overflow.  (Doesn't
 		// check that size & offsets are within bounds either for
 		// that matter...please convert fonts responsibly.)
+		// Use -2 for larger fonts.
 		table[j].bitmapOffset = bitmapOffset;
-		table[j].width        = bitmap->width;
-		table[j].height       = bitmap->rows;
-		table[j].xAdvance     = face->glyph->advance.x >> 6;
-		table[j].xOffset      = g->left;
-		table[j].yOffset      = 1 - g->top;
-
-		for(y=0; y < bitmap->rows; y++) {
-			for(x=0;x < bitmap->width; x++) {
-				byte = x / 8;
-				bit  = 0x80 >> (x & 7);
-				enbit(bitmap->buffer[
-				  y * bitmap->pitch + byte] & bit);
-			}
-		}
+		table[j].width        = w;
+		table[j].height       = h;
+		table[j].xAdvance     = xa;
+		table[j].xOffset      = xo;
+		table[j].yOffset      = yo;
+		bitmapOffset += bytes;
+	}
 
-		// Pad end of char bitmap to next byte boundary if needed
-		int n = (bitmap->width * bitmap->rows) & 7;
-		if(n) { // Pixel count not an even multiple of 8?
-			n = 8 - n; // # bits to next multiple
-			while(n--) enbit(0);
-		}
-		bitmapOffset += (bitmap->width * bitmap->rows + 7) / 8;
+	if (face->size->metrics.height == 0) {
+		// No face height info, assume fixed width and get from a glyph.
+		yAdvance = table[0].height;
+	} else {
+		yAdvance = face->size->metrics.height >> 6;
+	}
 
-		FT_Done_Glyph(glyph);
+	if(out) {
+		const void *sections[GFX_FILE_SECTIONS] = { bitmapData, table };
+		file.format   = 1;
+		file.first    = first;
+		file.last     = last;
+		file.yAdvance = yAdvance;
+		file.length[GFX_FILE_BITMAP] = bitmapOffset;
+		file.length[GFX_FILE_GLYPHS] = (last - first + 1) * sizeof(GFXglyph);
+		err = writeFile(&file, sections);
+		FT_Done_FreeType(library);
+		return err;
 	}
 
+	printf("#include \"../gfxfont.h\"\n"
+			"\n"
+			"static const uint8_t %sBitmaps[] PROGMEM = {\n", fontName);
+	printBitmap();
 	printf(" };\n\n"); // End bitmap array
 
 	// Output glyph attributes table (one per character)
@@ -224,14 +728,7 @@ int main(int argc, char *argv[]) {
 	printf("const GFXfont %s PROGMEM = {\n", fontName);
 	printf("  (uint8_t  *)%sBitmaps,\n", fontName);
 	printf("  (GFXglyph *)%sGlyphs,\n", fontName);
-	if (face->size->metrics.height == 0) {
-      // No face height info, assume fixed width and get from a glyph.
-		printf("  0x%02X, 0x%02X, %d };\n\n",
-			first, last, table[0].height);
-	} else {
-		printf("  0x%02X, 0x%02X, %ld };\n\n",
-			first, last, face->size->metrics.height >> 6);
-	}
+	printf("  0x%02X, 0x%02X, %d };\n\n", first, last, yAdvance);
 	printf("// Approx. %d bytes\n",
 	  bitmapOffset + (last - first + 1) * 7 + 7);
 	// Size estimate is based on AVR struct and pointer sizes;
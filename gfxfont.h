@@ -7,6 +7,7 @@
 #ifndef _GFXFONT_H_
 #define _GFXFONT_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -27,6 +28,110 @@ typedef struct { // Data stored for FONT AS A WHOLE:
 	uint8_t   yAdvance;    // Newline distance (y axis)
 } GFXfont;
 
+// Version 2 fonts for large and non-ASCII character sets.  Glyphs are
+// looked up by Unicode code point through a two-level page table:
+// pages[cp >> 8] selects a block of 256 entries in index, the entry for
+// (cp & 0xFF) is the glyph number + 1.  0 means absent at both levels.
+// Bitmaps are bit-packed like in GFXfont, offsets are 32-bit.  Fonts
+// with bpp 2 or 4 are anti-aliased: every pixel is a coverage value from
+// 0 (background) to 2^bpp - 1 (text color), MSB first, rows are packed
+// without padding like the bits of 1-bit glyphs.
+// Kerning pairs move the pen between two glyphs.  They are sorted by
+// (left glyph number << 16) | right glyph number, kernFilter has a bit per
+// glyph (MSB first) set if it is the left glyph of any pair, followed by
+// the same for right glyphs, so most pairs are rejected without a search.
+
+typedef struct { // Data stored PER GLYPH
+	uint32_t bitmapOffset;     // Pointer into GFXfont2->bitmap
+	uint16_t width, height;    // Bitmap dimensions in pixels
+	uint16_t xAdvance;         // Distance to advance cursor (x axis)
+	int16_t  xOffset, yOffset; // Dist from cursor pos to UL corner
+} GFXglyph2;
+
+typedef struct { // Data stored for FONT AS A WHOLE:
+	uint8_t   *bitmap;     // Glyph bitmaps, concatenated
+	GFXglyph2 *glyph;      // Glyph array
+	uint16_t  *pages;      // Block in index + 1 per 256 code points
+	uint16_t  *index;      // Blocks of 256 glyph numbers + 1
+	uint16_t   pageCount;  // Code points below pageCount * 256 are mapped
+	uint16_t   glyphCount; // Entries in glyph
+	uint16_t   yAdvance;   // Newline distance (y axis)
+	uint8_t    bpp;        // Bits per pixel, 1 (or 0), 2 or 4
+	uint32_t   kernCount;  // Kerning pairs, 0 for none
+	uint32_t  *kernPairs;  // Glyph numbers of the pairs
+	int8_t    *kernAmounts; // Pen movement of each pair in pixels
+	uint8_t   *kernFilter; // Glyphs used in pairs, left then right side
+} GFXfont2;
+
+// Glyph of code point cp, NULL if the font has none
+static inline const GFXglyph2 *gfxFont2Glyph(const GFXfont2 *font, uint32_t cp) {
+	uint32_t page = cp >> 8;
+	if (page >= font->pageCount || font->pages[page] == 0)
+		return NULL;
+	uint16_t g = font->index[(uint32_t)(font->pages[page] - 1) * 256 + (cp & 0xFF)];
+	return g ? &font->glyph[g - 1] : NULL;
+}
+
+// Pen movement between glyph numbers left and right
+static inline int gfxFont2Kerning(const GFXfont2 *font, uint16_t left, uint16_t right) {
+	if (font->kernCount == 0)
+		return 0;
+	const uint8_t *f = font->kernFilter;
+	if (!(f[left >> 3] & (0x80 >> (left & 7))))
+		return 0;
+	f += (font->glyphCount + 7) / 8;
+	if (!(f[right >> 3] & (0x80 >> (right & 7))))
+		return 0;
+	uint32_t key = ((uint32_t) left << 16) | right;
+	uint32_t lo = 0, hi = font->kernCount;
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (font->kernPairs[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < font->kernCount && font->kernPairs[lo] == key) ? font->kernAmounts[lo] : 0;
+}
+
+// Binary font files, written by fontconvert -b and mapped by FontFile.
+// The file is this header followed by the sections of the font, each at
+// a 4-byte aligned offset, with the byte order and struct layout of the
+// machine that wrote it: the bitmap, the GFXglyph or GFXglyph2 array and
+// for version 2 fonts the page table, the index blocks and the kerning
+// pairs, amounts and filter.  Absent sections have length 0.
+
+#define GFX_FILE_MAGIC   0x46584647 // "GFXF" little endian
+#define GFX_FILE_VERSION 1
+
+enum {
+	GFX_FILE_BITMAP,
+	GFX_FILE_GLYPHS,
+	GFX_FILE_PAGES,
+	GFX_FILE_INDEX,
+	GFX_FILE_KERN_PAIRS,
+	GFX_FILE_KERN_AMOUNTS,
+	GFX_FILE_KERN_FILTER,
+	GFX_FILE_SECTIONS
+};
+
+typedef struct { // Header of a binary font file
+	uint32_t magic;       // GFX_FILE_MAGIC
+	uint8_t  version;     // GFX_FILE_VERSION
+	uint8_t  format;      // 1 for GFXfont, 2 for GFXfont2
+	uint8_t  bpp;         // Bits per pixel of GFXfont2 glyphs
+	uint8_t  reserved;
+	uint16_t size;        // Point size, 0 for pixel fonts
+	uint16_t first, last; // GFXfont code extents
+	uint16_t yAdvance;    // Newline distance (y axis)
+	uint16_t pageCount;   // GFXfont2 entries in pages
+	uint16_t glyphCount;  // GFXfont2 entries in glyph
+	uint32_t kernCount;   // GFXfont2 kerning pairs
+	char     name[40];    // Font name without the size, NUL terminated
+	uint32_t offset[GFX_FILE_SECTIONS]; // Start of each section
+	uint32_t length[GFX_FILE_SECTIONS]; // Bytes in each section
+} GFXfontFile;
+
 
 extern const GFXfont FreeMono12pt7b;
 extern const GFXfont FreeMono18pt7b;
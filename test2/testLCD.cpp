@@ -2,6 +2,7 @@
 
 #include <chrono>
 
+#include "../FramePacer.h"
 #include "../OLEDDisplay.h"
 
 using std::chrono::steady_clock;
@@ -54,6 +55,11 @@ void testFPS() {
 
 	steady_clock::time_point lastTime = steady_clock::now();
 	uint32_t lastFC = disp.getFrameCounter();
+	uint32_t lastLate = 0;
+
+	// one physics step per frame, so the frame rate has to be stable
+	FramePacer pacer(60);
+	pacer.setSpin(std::chrono::microseconds(500));
 
 	const int radius=10;
 	const int minX = radius;
@@ -89,13 +95,17 @@ void testFPS() {
 		disp.clearScreen();
 		disp.fillCircle(posx, posy, radius);
 		disp.flush();
+		pacer.wait();
 
 		steady_clock::time_point curTime = steady_clock::now();
 		if (curTime - lastTime >= std::chrono::seconds(1)) {
 			uint32_t curFC = disp.getFrameCounter();
-			printf("fps: %d\n", curFC - lastFC);
+			uint32_t curLate = pacer.getLateFrames();
+			printf("fps: %d late: %d max lateness: %dus\n", curFC - lastFC, curLate - lastLate,
+					(int)std::chrono::duration_cast<std::chrono::microseconds>(pacer.getMaxLateness()).count());
 			lastTime = curTime;
 			lastFC = curFC;
+			lastLate = curLate;
 		}
 	}
 }
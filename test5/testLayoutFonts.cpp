@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../Canvas.h"
+
+using namespace GFX;
+
+// Layouts point into the bitmaps of the fonts the canvas repacked.  Select
+// a font, lay out a string, select enough other fonts to evict it, select
+// it again and draw the cached layout and a copy of it.  The same for a
+// font repacked by the caller and dropped by it.  Runs without display
+// hardware, best under AddressSanitizer.
+
+static const GFXfont *others[] = {
+	&FreeMono12pt7b, &FreeMono18pt7b, &FreeSans9pt7b, &FreeSans12pt7b,
+	&FreeSerif9pt7b, &FreeSerif12pt7b, &FreeMonoBold9pt7b, &FreeSansBold9pt7b
+};
+
+static bool same(Canvas8bpp &a, Canvas8bpp &b) {
+	return memcmp(a.getBuffer(), b.getBuffer(), (size_t) a.getWidth() * a.getHeight()) == 0;
+}
+
+int main(void) {
+	Canvas8bpp layout(128, 64), printed(128, 64);
+	printed.setFont(&FreeMono9pt7b);
+	printed.clearScreen();
+	printed.setCursor(0, 20);
+	printed.print("Hello");
+
+	layout.setFont(&FreeMono9pt7b);
+	TextLayout copy = layout.getTextLayout("Hello");
+	for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); i++)
+		layout.setFont(others[i]);
+	layout.setFont(&FreeMono9pt7b);
+
+	layout.clearScreen();
+	layout.drawText(layout.getTextLayout("Hello"), 0, 20);
+	bool cached = same(layout, printed);
+
+	// the copy outlives the cache entry
+	for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); i++)
+		layout.setFont(others[i]);
+	layout.setFont(&FreeMono9pt7b);
+	layout.clearScreen();
+	layout.drawText(copy, 0, 20);
+	bool copied = same(layout, printed);
+
+	// the canvas and the copy keep a font set by the caller
+	std::shared_ptr<const PreparedFont> prepared(new PreparedFont(&FreeMono9pt7b));
+	layout.setFont(prepared);
+	TextLayout own = layout.getTextLayout("Hello");
+	prepared.reset();
+	layout.clearScreen();
+	layout.drawText(own, 0, 20);
+	bool shared = same(layout, printed);
+	for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); i++)
+		layout.setFont(others[i]);
+	layout.clearScreen();
+	layout.drawText(own, 0, 20);
+	shared = shared && same(layout, printed);
+
+	printf("cached layout: %s\n", cached ? "ok" : "FAILED");
+	printf("copied layout: %s\n", copied ? "ok" : "FAILED");
+	printf("shared font: %s\n", shared ? "ok" : "FAILED");
+	return cached && copied && shared ? 0 : 1;
+}